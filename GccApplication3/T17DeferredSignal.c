@@ -0,0 +1,60 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Ping waits, TIMER3 posts two signals, Ping and Pong
+// both become ready at the next tick and Ping (higher priority) runs first.
+
+EVENT e1;
+EVENT e2;
+
+void Pong()
+{
+	for(;;){
+		Event_Wait(e2);
+		PORTA|=(1<<PA1);
+		PORTA&=~(1<<PA1);
+	}
+}
+
+void Ping()
+{
+	for(;;){
+		Event_Wait(e1);
+		PORTA|=(1<<PA2);
+		PORTA&=~(1<<PA2);
+	}
+}
+
+ISR(TIMER3_COMPA_vect)
+{
+	//no Enter_Kernel() here, both signals are applied in one kernel entry
+	PORTA|=(1<<PA0);
+	Defer_Event_Signal(e2);
+	Defer_Event_Signal(e1);
+	PORTA&=~(1<<PA0);
+}
+
+void a_main(){
+	DDRA |= (1<<PA0);
+	DDRA |= (1<<PA1);
+	DDRA |= (1<<PA2);
+	PORTA &= ~(1<<PA0);
+	PORTA &= ~(1<<PA1);
+	PORTA &= ~(1<<PA2);
+	e1=Event_Init();
+	e2=Event_Init();
+	Task_Create(Ping,1,0);
+	Task_Create(Pong,2,0);
+
+	TCCR3A = 0;
+	TCCR3B = (1<<WGM32)|(1<<CS32);
+	OCR3A = 6250;
+	TIMSK3 |= (1<<OCIE3A);
+	Task_Terminate();
+}
+*/
@@ -0,0 +1,48 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED: PA0 toggles every 10 ticks, PA1 pulses once after 25 ticks,
+// PA2 pulses every 50 ticks. Only a_main and the timer service task exist.
+
+TIMER blink;
+TIMER once;
+TIMER watchdog;
+
+void Blink()
+{
+	PORTA^=(1<<PA0);
+}
+
+void Once()
+{
+	PORTA|=(1<<PA1);
+	PORTA&=~(1<<PA1);
+}
+
+void Kick()
+{
+	PORTA|=(1<<PA2);
+	PORTA&=~(1<<PA2);
+}
+
+void a_main(){
+	DDRA |= (1<<PA0);
+	DDRA |= (1<<PA1);
+	DDRA |= (1<<PA2);
+	PORTA &= ~(1<<PA0);
+	PORTA &= ~(1<<PA1);
+	PORTA &= ~(1<<PA2);
+	blink=Timer_Create(10,0,Blink);
+	once=Timer_Create(25,1,Once);
+	watchdog=Timer_Create(50,0,Kick);
+	Timer_Start(blink);
+	Timer_Start(once);
+	Timer_Start(watchdog);
+	Task_Terminate();
+}
+*/
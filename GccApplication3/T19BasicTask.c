@@ -0,0 +1,43 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Poll (PA0 high), Blink nests on top of it (PA1),
+// Poll finishes (PA0 low). Both run on the shared basic stack, driven by
+// software timers; no per-task workspace is used for either.
+
+BASIC_TASK poll;
+BASIC_TASK blink;
+
+void Blink()
+{
+	PORTA^=(1<<PA1);
+}
+
+void Poll()
+{
+	PORTA|=(1<<PA0);
+	Basic_Activate(blink);	//higher priority, runs before Poll continues
+	PORTA&=~(1<<PA0);
+}
+
+void Tick()
+{
+	Basic_Activate(poll);
+}
+
+void a_main(){
+	DDRA |= (1<<PA0);
+	DDRA |= (1<<PA1);
+	PORTA &= ~(1<<PA0);
+	PORTA &= ~(1<<PA1);
+	poll=Basic_Create(Poll,5);
+	blink=Basic_Create(Blink,2);
+	Timer_Start(Timer_Create(10,0,Tick));
+	Task_Terminate();
+}
+*/
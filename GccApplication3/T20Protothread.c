@@ -0,0 +1,56 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "pt.h"
+#include "error_code.h"
+
+// EXPECTED: PA0 toggles every 10 ticks from a sleeping protothread, PA1
+// pulses each time Signaller raises the event. Neither protothread has a
+// stack or a process descriptor.
+
+EVENT e;
+
+void Blinker()
+{
+	PT_BEGIN();
+	for(;;){
+		PORTA^=(1<<PA0);
+		PT_SLEEP(10);
+	}
+	PT_END();
+}
+
+void Listener()
+{
+	PT_BEGIN();
+	for(;;){
+		PT_WAIT_EVENT(e);
+		PORTA|=(1<<PA1);
+		PORTA&=~(1<<PA1);
+	}
+	PT_END();
+}
+
+void Signaller()
+{
+	for(;;){
+		Task_Sleep(25);
+		Event_Signal(e);
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0);
+	DDRA |= (1<<PA1);
+	PORTA &= ~(1<<PA0);
+	PORTA &= ~(1<<PA1);
+	e=Event_Init();
+	Pt_Create(Blinker,3);
+	Pt_Create(Listener,2);
+	Task_Create(Signaller,4,0);
+	Task_Terminate();
+}
+*/
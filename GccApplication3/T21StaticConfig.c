@@ -0,0 +1,41 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// Needs this in os_config.h:
+//
+// #define OS_STATIC_TASKS(TASK) \
+// 	TASK(Producer, 2, 0, 128) \
+// 	TASK(Consumer, 1, 0, 128)
+// #define OS_STATIC_MUTEXES(MUTEX_)	MUTEX_(buffer_lock)
+// #define OS_STATIC_EVENTS(EVENT_)	EVENT_(data_ready)
+//
+// EXPECTED RUNNING ORDER: Consumer (higher priority) waits on data_ready,
+// Producer takes buffer_lock, sets PA0 and signals, Consumer sets PA1.
+// Nothing is created at run time and a_main never runs.
+
+void Producer()
+{
+	Mutex_Lock(buffer_lock);
+	PORTA|=(1<<PA0);
+	Mutex_Unlock(buffer_lock);
+	Event_Signal(data_ready);
+}
+
+void Consumer()
+{
+	DDRA |= (1<<PA0);
+	DDRA |= (1<<PA1);
+	PORTA &= ~(1<<PA0);
+	PORTA &= ~(1<<PA1);
+	Event_Wait(data_ready);
+	PORTA|=(1<<PA1);
+}
+
+void a_main(){
+}
+*/
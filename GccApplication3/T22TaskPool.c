@@ -0,0 +1,34 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Job toggles PA0 five times, each run on the same
+// pool worker (PID printed on PORTB stays the same). PORTD holds the cycles
+// of the last Task_Create() divided by 16, for comparison with the pool.
+
+void Job()
+{
+	PORTA^=(1<<PA0);
+}
+
+void Dummy()
+{
+}
+
+void a_main(){
+	int i;
+	DDRA |= (1<<PA0);
+	DDRB = 0xFF;
+	DDRD = 0xFF;
+	for(i=0;i<5;i++){
+		PORTB=TaskPool_Acquire(Job,i);
+		Task_Sleep(10);
+	}
+	Task_Create(Dummy,0,0);
+	PORTD=Task_CreateCycles()/16;
+}
+*/
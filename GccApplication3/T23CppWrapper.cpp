@@ -0,0 +1,168 @@
+/*
+#include <avr/io.h>
+#include "os.hpp"
+
+// EXPECTED RUNNING ORDER: Producer sends 1..5 through the queue, Consumer
+// (higher priority) shows each value on PORTA. Build this file once as is and
+// once with CPP_WRAPPER undefined: the #else branch is the same program, queue,
+// pool and lock included, written by hand on the C API, so avr-size and
+// avr-objdump -d of the two builds show what the wrapper costs.
+
+#define CPP_WRAPPER
+
+struct Sample { unsigned char value; };
+
+#ifdef CPP_WRAPPER
+os::Mutex lock;
+os::Queue<Sample,4> queue;
+os::Pool<Sample,4> pool;
+
+void Consumer()
+{
+	Sample s;
+	for(;;){
+		queue.receive(s);
+		os::LockGuard g(lock);
+		PORTA=s.value;
+	}
+}
+
+void Producer()
+{
+	for(unsigned char i=1;i<=5;i++){
+		Sample* s=pool.acquire();
+		s->value=i;
+		queue.send(*s);
+		pool.release(s);
+		os::Task::sleep(10);
+	}
+}
+
+constexpr os::TaskDesc consumer(Consumer,1);
+constexpr os::TaskDesc producer(Producer,2);
+
+extern "C" void a_main(){
+	DDRA=0xFF;
+	lock.init();
+	queue.init();
+	os::Task::create(consumer);
+	os::Task::create(producer);
+}
+#else
+#include <avr/interrupt.h>
+
+struct SampleQueue
+{
+	Sample buf[4];
+	volatile unsigned char head;
+	volatile unsigned char count;
+	EVENT not_empty;
+	EVENT not_full;
+};
+
+union SampleBlock
+{
+	Sample value;
+	unsigned char next;
+};
+
+MUTEX lock;
+struct SampleQueue queue;
+union SampleBlock pool[4];
+unsigned char pool_free;
+
+static int queue_try_send(const Sample* v)
+{
+	uint8_t sreg=SREG;
+	int sent=0;
+
+	cli();
+	if(queue.count!=4){
+		queue.buf[(unsigned char)(queue.head+queue.count)%4]=*v;
+		++queue.count;
+		sent=1;
+	}
+	asm volatile ("" ::: "memory");
+	SREG=sreg;
+	return sent;
+}
+
+static int queue_try_receive(Sample* v)
+{
+	uint8_t sreg=SREG;
+	int received=0;
+
+	cli();
+	if(queue.count!=0){
+		*v=queue.buf[queue.head];
+		queue.head=(unsigned char)(queue.head+1)%4;
+		--queue.count;
+		received=1;
+	}
+	asm volatile ("" ::: "memory");
+	SREG=sreg;
+	return received;
+}
+
+static Sample* pool_acquire(void)
+{
+	uint8_t sreg=SREG;
+	union SampleBlock* b=NULL;
+
+	cli();
+	if(pool_free!=4){
+		b=&pool[pool_free];
+		pool_free=b->next;
+	}
+	asm volatile ("" ::: "memory");
+	SREG=sreg;
+	return b?&b->value:NULL;
+}
+
+static void pool_release(Sample* p)
+{
+	uint8_t sreg=SREG;
+	union SampleBlock* b=(union SampleBlock*)p;
+
+	cli();
+	b->next=pool_free;
+	pool_free=(unsigned char)(b-pool);
+	asm volatile ("" ::: "memory");
+	SREG=sreg;
+}
+
+void Consumer()
+{
+	Sample s;
+	for(;;){
+		while(!queue_try_receive(&s)) Event_Wait(queue.not_empty);
+		Event_Signal(queue.not_full);
+		Mutex_Lock(lock);
+		PORTA=s.value;
+		Mutex_Unlock(lock);
+	}
+}
+
+void Producer()
+{
+	for(unsigned char i=1;i<=5;i++){
+		Sample* s=pool_acquire();
+		s->value=i;
+		while(!queue_try_send(s)) Event_Wait(queue.not_full);
+		Event_Signal(queue.not_empty);
+		pool_release(s);
+		Task_Sleep(10);
+	}
+}
+
+extern "C" void a_main(){
+	DDRA=0xFF;
+	for(unsigned char i=0;i<4;i++) pool[i].next=i+1;
+	lock=Mutex_Init();
+	queue.not_empty=Event_Init();
+	queue.not_full=Event_Init();
+	Task_Create(Consumer,1,0);
+	Task_Create(Producer,2,0);
+}
+#endif
+*/
@@ -0,0 +1,50 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// Build with -DDEADLOCK_CHECK=1.
+// EXPECTED RUNNING ORDER: A holds M1, B holds M2, A blocks on M2. B's lock of
+// M1 would close the cycle, so it is refused: PA0 goes high and PORTB shows
+// the cycle length (2). B releases M2 and A finishes (PA1 high).
+// With -DDEADLOCK_CHECK=2 the same lock aborts, PC0 and PC3 flash.
+
+MUTEX m1;
+MUTEX m2;
+
+void A()
+{
+	Mutex_Lock(m1);
+	Task_Sleep(2);
+	Mutex_Lock(m2);
+	PORTA|=(1<<PA1);
+	Mutex_Unlock(m2);
+	Mutex_Unlock(m1);
+}
+
+void B()
+{
+	Mutex_Lock(m2);
+	Task_Sleep(4);
+	if(!Mutex_Lock(m1)){
+		PORTA|=(1<<PA0);
+		PORTB=Mutex_GetDeadlock()->length;
+	}
+	Mutex_Unlock(m2);
+}
+
+void a_main(){
+	DDRA |= (1<<PA0);
+	DDRA |= (1<<PA1);
+	DDRB = 0xFF;
+	PORTA &= ~(1<<PA0);
+	PORTA &= ~(1<<PA1);
+	m1=Mutex_Init();
+	m2=Mutex_Init();
+	Task_Create(A,1,0);
+	Task_Create(B,2,0);
+}
+*/
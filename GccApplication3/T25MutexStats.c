@@ -0,0 +1,50 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// Build with -DOS_MUTEX_STATS, USART0 (pin 1, TX0) at 38400 8N1.
+// EXPECTED OUTPUT after about one second, once:
+//   mutex 0 acq 20 contended 10 wait .../... hold .../... holder ...
+// Slow holds the mutex for 3 ticks at a time, Fast keeps waiting for it, so
+// about half the acquisitions are contended and the longest holder is Slow.
+
+MUTEX m;
+
+void Slow()
+{
+	int i;
+	for(i=0;i<10;i++){
+		Mutex_Lock(m);
+		Task_Sleep(3);
+		Mutex_Unlock(m);
+		Task_Sleep(1);
+	}
+}
+
+void Fast()
+{
+	int i;
+	for(i=0;i<10;i++){
+		Task_Sleep(1);
+		Mutex_Lock(m);
+		Mutex_Unlock(m);
+	}
+}
+
+void Report()
+{
+	Task_Sleep(100);
+	Mutex_DumpStats();
+}
+
+void a_main(){
+	m=Mutex_Init();
+	Task_Create(Slow,2,0);
+	Task_Create(Fast,1,0);
+	Task_Create(Report,5,0);
+}
+*/
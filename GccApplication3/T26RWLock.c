@@ -0,0 +1,49 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Reader 1 and Reader 2 hold the lock together
+// (PA0, PA1 high). Writer blocks on them and Reader 1 runs at its priority.
+// Reader 3 arrives after Writer and waits behind it (writer preference):
+// PA2 (Writer) goes high before PA3 (Reader 3).
+
+RWLOCK sensor;
+
+void Reader()
+{
+	RWLock_ReadLock(sensor);
+	PORTA|=(1<<Task_GetArg());
+	Task_Sleep(3+Task_GetArg());
+	RWLock_ReadUnlock(sensor);
+}
+
+void Writer()
+{
+	Task_Sleep(1);
+	RWLock_WriteLock(sensor);
+	PORTA|=(1<<PA2);
+	RWLock_WriteUnlock(sensor);
+}
+
+void LateReader()
+{
+	Task_Sleep(2);
+	RWLock_ReadLock(sensor);
+	PORTA|=(1<<PA3);
+	RWLock_ReadUnlock(sensor);
+}
+
+void a_main(){
+	DDRA = 0x0F;
+	PORTA = 0;
+	sensor=RWLock_Init();
+	Task_Create(Reader,3,PA0);
+	Task_Create(Reader,4,PA1);
+	Task_Create(Writer,1,0);
+	Task_Create(LateReader,2,0);
+}
+*/
@@ -0,0 +1,53 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: the TIMER3 ISR publishes a new sample every 1 ms
+// (x and y always equal); Reader copies it as often as it can and never sees
+// x != y. PA0 toggles on every read, PA1 would go high on a torn read.
+
+typedef struct
+{
+	int x;
+	int y;
+} Sample;
+
+SNAPSHOT_DECLARE(imu, Sample);
+volatile int counter;
+
+ISR(TIMER3_COMPA_vect)
+{
+	Sample s;
+	s.x=++counter;
+	s.y=counter;
+	Snapshot_Publish(&imu,&s);
+}
+
+void Reader()
+{
+	Sample s;
+	for(;;){
+		Snapshot_Read(&imu,&s);
+		if(s.x!=s.y){
+			PORTA|=(1<<PA1);
+		}
+		PORTA^=(1<<PA0);
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0);
+	DDRA |= (1<<PA1);
+	PORTA &= ~(1<<PA0);
+	PORTA &= ~(1<<PA1);
+	TCCR3A = 0;
+	TCCR3B = (1<<WGM32)|(1<<CS31);	//CTC, /8
+	OCR3A = 2000;					//1 ms
+	TIMSK3 |= (1<<OCIE3A);
+	Task_Create(Reader,5,0);
+}
+*/
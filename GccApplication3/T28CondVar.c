@@ -0,0 +1,56 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: both Consumers wait on the condition. Producer adds
+// one item and signals: Consumer 1 (higher priority) takes it (PA0 toggles).
+// Producer then adds two and broadcasts: Consumer 1 and then Consumer 2 each
+// take one (PA0, then PA1 toggle). No item is taken twice or missed.
+
+MUTEX lock;
+COND nonempty;
+int items;
+
+void Consumer()
+{
+	for(;;){
+		Mutex_Lock(lock);
+		while(items==0){
+			Cond_Wait(nonempty,lock);
+		}
+		--items;
+		PORTA^=(1<<Task_GetArg());
+		Mutex_Unlock(lock);
+	}
+}
+
+void Producer()
+{
+	Task_Sleep(1);
+	Mutex_Lock(lock);
+	items=1;
+	Cond_Signal(nonempty);
+	Mutex_Unlock(lock);
+	Task_Sleep(1);
+	Mutex_Lock(lock);
+	items=2;
+	Cond_Broadcast(nonempty);
+	Mutex_Unlock(lock);
+}
+
+void a_main(){
+	DDRA |= (1<<PA0);
+	DDRA |= (1<<PA1);
+	PORTA &= ~(1<<PA0);
+	PORTA &= ~(1<<PA1);
+	lock=Mutex_Init();
+	nonempty=Cond_Init();
+	Task_Create(Consumer,2,PA0);
+	Task_Create(Consumer,3,PA1);
+	Task_Create(Producer,4,0);
+}
+*/
@@ -0,0 +1,45 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Client 1 sends first and the low-priority Server
+// serves it at Client 1's priority; the reply (request + 1) shows on PORTB.
+// Then Client 2 is served. PA0 is high while Server runs above priority 5.
+
+PID server;
+
+void Server()
+{
+	unsigned char req;
+	unsigned char reply;
+	PID from;
+	for(;;){
+		Msg_Receive(&from,&req,1);
+		PORTA|=(1<<PA0);
+		reply=req+1;
+		Msg_Reply(from,&reply,1);
+		PORTA&=~(1<<PA0);
+	}
+}
+
+void Client()
+{
+	unsigned char req=Task_GetArg();
+	unsigned char reply;
+	Msg_Send(server,&req,1,&reply,1);
+	PORTB=reply;
+}
+
+void a_main(){
+	DDRA |= (1<<PA0);
+	DDRB = 0xFF;
+	PORTA &= ~(1<<PA0);
+	server=Task_Create(Server,5,0);
+	Task_Create(Client,1,10);
+	Task_Create(Client,2,20);
+}
+*/
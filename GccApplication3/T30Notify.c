@@ -0,0 +1,54 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: the INT0 ISR (button on pin 21) notifies Handler
+// with bit 0, the 10 ms Tick task with bit 1. Handler toggles PA0 per button
+// press and PA1 every 100 ticks; if neither comes for 200 ticks, PA2 toggles
+// (timeout). No EVENT is created.
+
+PID handler;
+
+ISR(INT0_vect)
+{
+	Defer_Task_Notify(handler,1<<0,NOTIFY_SET_BITS);
+}
+
+void Handler()
+{
+	unsigned char bits;
+	for(;;){
+		bits=Task_NotifyWait((1<<0)|(1<<1),200);
+		if(bits&(1<<0)){
+			PORTA^=(1<<PA0);
+		}
+		if(bits&(1<<1)){
+			PORTA^=(1<<PA1);
+		}
+		if(!bits){
+			PORTA^=(1<<PA2);
+		}
+	}
+}
+
+void Tick()
+{
+	for(;;){
+		Task_Sleep(100);
+		Task_Notify(handler,1<<1,NOTIFY_SET_BITS);
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0)|(1<<PA1)|(1<<PA2);
+	PORTA = 0;
+	EICRA |= (1<<ISC01);	//falling edge
+	EIMSK |= (1<<INT0);
+	handler=Task_Create(Handler,1,0);
+	Task_Create(Tick,2,0);
+}
+*/
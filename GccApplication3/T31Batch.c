@@ -0,0 +1,78 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Control (lowest priority) holds the mutex while it
+// sets up a frame, then in one kernel request unlocks it, signals the event,
+// resumes Logger and notifies Display. Only after the batch do the four woken
+// tasks run, highest first: Writer (PA0), Logger (PA1), Reader (PA2),
+// Display (PA3). Control toggles PA4 once they have all finished.
+
+EVENT frame;
+MUTEX buffer;
+PID logger, display;
+
+void Writer()
+{
+	for(;;){
+		Mutex_Lock(buffer);
+		PORTA^=(1<<PA0);
+		Mutex_Unlock(buffer);
+		Task_Sleep(100);
+	}
+}
+
+void Logger()
+{
+	for(;;){
+		Task_Suspend(logger);
+		PORTA^=(1<<PA1);
+	}
+}
+
+void Reader()
+{
+	for(;;){
+		Event_Wait(frame);
+		PORTA^=(1<<PA2);
+	}
+}
+
+void Display()
+{
+	for(;;){
+		Task_NotifyWait(1<<0,NOTIFY_FOREVER);
+		PORTA^=(1<<PA3);
+	}
+}
+
+void Control()
+{
+	for(;;){
+		Mutex_Lock(buffer);
+		Task_Sleep(100);
+		KERNEL_BATCH({BATCH_UNLOCK,buffer},
+			{BATCH_SIGNAL,frame},
+			{BATCH_RESUME,logger},
+			{BATCH_NOTIFY,display,1<<0});
+		PORTA^=(1<<PA4);
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0)|(1<<PA1)|(1<<PA2)|(1<<PA3)|(1<<PA4);
+	PORTA = 0;
+	frame=Event_Init();
+	buffer=Mutex_Init();
+	Task_Create(Control,5,0);
+	Task_Sleep(1);
+	Task_Create(Writer,1,0);
+	logger=Task_Create(Logger,2,0);
+	Task_Create(Reader,3,0);
+	display=Task_Create(Display,4,0);
+}
+*/
@@ -0,0 +1,69 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Radio and Decoder share priority 1 with Logger.
+// Radio fills a frame, toggles PA0 and hands the CPU straight to Decoder,
+// which toggles PA1 and hands it back, so Logger (PA2) only runs when the
+// pair sleeps. Decoder also asks Checker (priority 2) to verify each frame
+// with Msg_Send(); Checker, blocked in Msg_Receive(), runs at once (PA3).
+
+PID radio, decoder, checker;
+char frame[8];
+
+void Radio()
+{
+	for(;;){
+		memset(frame,'r',sizeof frame);
+		PORTA^=(1<<PA0);
+		Task_YieldTo(decoder);
+		Task_Sleep(10);
+	}
+}
+
+void Decoder()
+{
+	int ok;
+	for(;;){
+		Msg_Send(checker,frame,sizeof frame,&ok,sizeof ok);
+		if(ok){
+			PORTA^=(1<<PA1);
+		}
+		Task_YieldTo(radio);
+	}
+}
+
+void Logger()
+{
+	for(;;){
+		PORTA^=(1<<PA2);
+		Task_Yield();
+	}
+}
+
+void Checker()
+{
+	char buf[8];
+	PID from;
+	int ok;
+	for(;;){
+		Msg_Receive(&from,buf,sizeof buf);
+		ok=(buf[0]=='r');
+		PORTA^=(1<<PA3);
+		Msg_Reply(from,&ok,sizeof ok);
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0)|(1<<PA1)|(1<<PA2)|(1<<PA3);
+	PORTA = 0;
+	checker=Task_Create(Checker,2,0);
+	radio=Task_Create(Radio,1,0);
+	decoder=Task_Create(Decoder,1,0);
+	Task_Create(Logger,1,0);
+}
+*/
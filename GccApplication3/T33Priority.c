@@ -0,0 +1,78 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Forward (PA0) and Telemetry (PA1) share the link
+// mutex. While the button on pin 21 (PD0) is held low the gateway is
+// overloaded: Monitor drops Telemetry from priority 3 to 9 and raises Forward
+// to 1, and puts them back once it is released. PA2 shows the overload;
+// Idle (priority 8) then starves Telemetry.
+// If Telemetry holds the link when it is demoted it keeps Forward's priority
+// until Mutex_Unlock(), so Forward never waits behind Idle (PA3) for it.
+
+MUTEX link;
+PID forward, telemetry;
+
+void Forward()
+{
+	for(;;){
+		Mutex_Lock(link);
+		PORTA^=(1<<PA0);
+		Mutex_Unlock(link);
+		Task_Sleep(5);
+	}
+}
+
+void Telemetry()
+{
+	for(;;){
+		Mutex_Lock(link);
+		PORTA^=(1<<PA1);
+		Task_Sleep(3);
+		Mutex_Unlock(link);
+		Task_Sleep(20);
+	}
+}
+
+void Idle()
+{
+	for(;;){
+		PORTA^=(1<<PA3);
+	}
+}
+
+void Monitor()
+{
+	for(;;){
+		if(!(PIND&(1<<PD0))){
+			if(Task_GetPriority(telemetry)!=9){
+				Task_SetPriority(telemetry,9);
+				Task_SetPriority(forward,1);
+				PORTA|=(1<<PA2);
+			}
+		}
+		else if(Task_GetPriority(telemetry)!=3){
+			Task_SetPriority(telemetry,3);
+			Task_SetPriority(forward,2);
+			PORTA&=~(1<<PA2);
+		}
+		Task_Sleep(10);
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0)|(1<<PA1)|(1<<PA2)|(1<<PA3);
+	PORTA = 0;
+	DDRD &= ~(1<<PD0);
+	PORTD |= (1<<PD0);	//pull-up
+	link=Mutex_Init();
+	Task_Create(Monitor,0,0);
+	forward=Task_Create(Forward,2,0);
+	telemetry=Task_Create(Telemetry,3,0);
+	Task_Create(Idle,8,0);
+}
+*/
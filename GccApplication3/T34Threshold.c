@@ -0,0 +1,79 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Sampler (priority 3) and Filter (priority 2) share
+// the samples buffer without a mutex: Sampler's threshold is 2, so Filter,
+// made ready by the event, waits until Sampler sleeps (PA0 then PA1, never
+// interleaved). Alarm (priority 1) is above the threshold and still preempts
+// Sampler at once (PA2). Build with OS_SWITCH_STATS; PORTC shows the low
+// byte of OS_GetSwitches() every second, which drops once Sampler sets its
+// threshold.
+
+#define N 16
+int samples[N];
+EVENT filled;
+PID sampler;
+
+void Sampler()
+{
+	unsigned char i;
+	Task_SetThreshold(sampler,2);
+	for(;;){
+		PORTA|=(1<<PA0);
+		for(i=0;i<N;i++){
+			samples[i]=i;
+			if(i==N/2){
+				Event_Signal(filled);
+			}
+		}
+		PORTA&=~(1<<PA0);
+		Task_Sleep(2);
+	}
+}
+
+void Filter()
+{
+	unsigned char i;
+	long sum;
+	for(;;){
+		Event_Wait(filled);
+		PORTA|=(1<<PA1);
+		for(sum=0,i=0;i<N;i++){
+			sum+=samples[i];
+		}
+		PORTA&=~(1<<PA1);
+	}
+}
+
+void Alarm()
+{
+	for(;;){
+		Task_Sleep(7);
+		PORTA^=(1<<PA2);
+	}
+}
+
+void Report()
+{
+	for(;;){
+		Task_Sleep(100);
+		PORTC=(unsigned char)OS_GetSwitches();
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0)|(1<<PA1)|(1<<PA2);
+	DDRC = 0xFF;
+	PORTA = 0;
+	filled=Event_Init();
+	Task_Create(Alarm,1,0);
+	Task_Create(Filter,2,0);
+	sampler=Task_Create(Sampler,3,0);
+	Task_Create(Report,0,0);
+}
+*/
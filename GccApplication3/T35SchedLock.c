@@ -0,0 +1,62 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// EXPECTED RUNNING ORDER: Logger (priority 5) copies the 16-byte record that
+// Sampler (priority 1) rewrites every tick, under Sched_Lock() instead of
+// cli/sei. The INT0 ISR (button on pin 21) keeps toggling PA2 immediately
+// while the copy runs, but Sampler, woken meanwhile, only runs (PA1) after
+// Sched_Unlock(). PA0 is high during the copy; a torn record lights PA3.
+
+typedef struct { unsigned char seq; unsigned char data[15]; } RECORD;
+RECORD record;
+
+ISR(INT0_vect)
+{
+	PORTA^=(1<<PA2);
+}
+
+void Sampler()
+{
+	unsigned char i;
+	for(;;){
+		Task_Sleep(1);
+		PORTA^=(1<<PA1);
+		++record.seq;
+		for(i=0;i<sizeof record.data;i++){
+			record.data[i]=record.seq;
+		}
+	}
+}
+
+void Logger()
+{
+	RECORD copy;
+	unsigned char i;
+	for(;;){
+		Sched_Lock();
+		PORTA|=(1<<PA0);
+		copy=record;
+		PORTA&=~(1<<PA0);
+		Sched_Unlock();
+		for(i=0;i<sizeof copy.data;i++){
+			if(copy.data[i]!=copy.seq){
+				PORTA|=(1<<PA3);
+			}
+		}
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0)|(1<<PA1)|(1<<PA2)|(1<<PA3);
+	PORTA = 0;
+	EICRA |= (1<<ISC01);	//falling edge
+	EIMSK |= (1<<INT0);
+	Task_Create(Sampler,1,0);
+	Task_Create(Logger,5,0);
+}
+*/
@@ -0,0 +1,54 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// Build with TASK_BUDGETS=1.
+// EXPECTED RUNNING ORDER: Runaway (priority 1) spins forever like Ping1 in
+// T6MaxP.c, but may only use 5 ticks of every 20: it is then demoted until
+// its period ends, and Heartbeat (priority 4) gets to toggle PA1. Burst
+// (priority 2) is suspended instead once it spends 2 ticks of every 50. PA0
+// is high while Runaway spins; PORTC shows how many times it overran.
+
+PID runaway, burst;
+
+void Runaway()
+{
+	for(;;){
+		PORTA|=(1<<PA0);
+	}
+}
+
+void Burst()
+{
+	for(;;){
+		PORTA^=(1<<PA2);
+	}
+}
+
+void Heartbeat()
+{
+	struct budget_stat s;
+	for(;;){
+		PORTA&=~(1<<PA0);
+		PORTA^=(1<<PA1);
+		Task_GetBudgetStats(runaway,&s);
+		PORTC=(unsigned char)s.overruns;
+		Task_Sleep(1);
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0)|(1<<PA1)|(1<<PA2);
+	DDRC = 0xFF;
+	PORTA = 0;
+	runaway=Task_Create(Runaway,1,0);
+	Task_SetBudget(runaway,5,20,BUDGET_DEMOTE);
+	burst=Task_Create(Burst,2,0);
+	Task_SetBudget(burst,2,50,BUDGET_SUSPEND);
+	Task_Create(Heartbeat,4,0);
+}
+*/
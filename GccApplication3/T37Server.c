@@ -0,0 +1,51 @@
+/*
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <limits.h>
+#include "os.h"
+#include "error_code.h"
+
+// Build with TASK_BUDGETS=1.
+// EXPECTED RUNNING ORDER: Control (priority 3) toggles PA0 every 5 ticks.
+// Each button press on pin 21 (INT0) posts a 1-tick frame job to the server
+// (priority 1), which toggles PA1 per job. Hammering the button queues jobs
+// faster than they can run, but the server may only use 2 ticks of every
+// 10, so PA0 keeps its 5-tick rhythm; PA2 lights when a job is dropped
+// because the queue is full.
+
+SERVER frames;
+
+void Frame(int n)
+{
+	TICK start=OS_GetTicks();
+	PORTA^=(1<<PA1);
+	while(OS_GetTicks()==start)
+		;
+}
+
+ISR(INT0_vect)
+{
+	static int n;
+	if(!Defer_Server_Post(frames,Frame,n++)){
+		PORTA|=(1<<PA2);
+	}
+}
+
+void Control()
+{
+	for(;;){
+		PORTA^=(1<<PA0);
+		Task_Sleep(5);
+	}
+}
+
+void a_main(){
+	DDRA |= (1<<PA0)|(1<<PA1)|(1<<PA2);
+	PORTA = 0;
+	frames=Server_Create(1,2,10);
+	Task_Create(Control,3,0);
+	EICRA |= (1<<ISC01);	//falling edge
+	EIMSK |= (1<<INT0);
+}
+*/
@@ -18,6 +18,16 @@ ERR_2_TOO_MANY_MUTEX,
 ERR_3_NO_SUCH_TASK,
 /** No such mutex */
 ERR_4_NO_SUCH_MUTEX,
+/** Too many software timers */
+ERR_5_TOO_MANY_TIMER,
+/** Too many reader-writer locks */
+ERR_6_TOO_MANY_RWLOCK,
+/** Too many condition variables */
+ERR_7_TOO_MANY_COND,
+/** Priority outside 0..MINPRIORITY */
+ERR_8_NO_SUCH_PRIORITY,
+/** Too many aperiodic servers */
+ERR_9_TOO_MANY_SERVER,
 
 
 /** Unrecoverable Errors */
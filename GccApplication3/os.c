@@ -29,8 +29,28 @@
 */
 
 
-#define WORKSPACE     256
-#define MAXPROCESS   16
+#define MAXPROCESS   MAXTHREAD
+/* PDs past the MAXPROCESS task slots: the idle task, then basic_runner. */
+#if MAXBASIC > 0
+#define KERNEL_PDS   2
+#else
+#define KERNEL_PDS   1
+#endif
+
+#ifdef OS_USE_XMEM
+#define WORKSPACE_SECTION __attribute__((section(".xmem")))
+
+/**
+  * Turn on the external memory interface before the C runtime touches RAM.
+  */
+void xmem_init(void) __attribute__((naked, used, section(".init3")));
+void xmem_init(void)
+{
+	XMCRA |= (1<<SRE);
+}
+#else
+#define WORKSPACE_SECTION
+#endif
 
 
 
@@ -67,26 +87,194 @@ extern void Enter_Kernel();
 
 /** Argument and return value for Event class of requests. */
 static volatile EVENT* kernel_request_event_ptr;
+/** Handle handed back by an EVENT_INIT request. */
+static EVENT kernel_request_event;
+/** Argument for Task_Suspend()/Task_Resume() requests. */
+static volatile PID kernel_request_pid;
+/** Sched_Lock() nesting; while non-zero, preemption() leaves Cp running. */
+static volatile uint8_t sched_lock;
+/** A preemption was held back by Sched_Lock(), for Sched_Unlock() to do. */
+static volatile uint8_t sched_pending;
+#if TASK_BUDGETS
+static BUDGET Budget[MAXPROCESS];
+/** Throttled tasks; the tick looks for due replenishments only while non-zero. */
+static volatile uint8_t budget_throttled;
+/** Arguments for Task_SetBudget() requests, with kernel_request_pid. */
+static struct { unsigned int budget, period; unsigned char action; } kernel_request_budget;
+static int budget_throttle(volatile PD* p);
+static int budget_replenish(volatile PD* p);
+#endif
+#if MAXSERVER > 0
+static SD Server[MAXSERVER];
+/** Some SD::wake_lost is set; the tick looks for them only while non-zero. */
+static volatile uint8_t server_wake_lost;
+#endif
+#ifdef OS_SWITCH_STATS
+/** Tasks resumed by the kernel since OS_Start, counted when Cp changes. */
+static unsigned long switch_count;
+static volatile PD* switch_last;
+#endif
+/** Argument for Task_SetPriority()/Task_SetThreshold() requests, with kernel_request_pid. */
+static volatile PRIORITY kernel_request_priority;
+/** Arguments for Kernel_Batch() requests. */
+static const KERNEL_OP* kernel_batch_ops;
+static unsigned char kernel_batch_count;
+/** Argument for Basic_Activate() requests. */
+static volatile BASIC_TASK kernel_request_basic;
 /**
   * This table contains ALL process descriptors. It doesn't matter what
   * state a task is in.
   */
 
-volatile static PD Process[MAXPROCESS+1];
+#ifdef OS_STATIC_TASKS
+/* Static tasks own the lowest pids, see os_config.h. */
+typedef char os_static_tasks_fit[(OS_STATIC_TASK_COUNT < MAXPROCESS) ? 1 : -1];
+
+#define OS_STATIC_STACK(f,py,arg,size) \
+	static unsigned char f##_stack[size] WORKSPACE_SECTION;
+OS_STATIC_TASKS(OS_STATIC_STACK)
+
+/**
+  * A static task starts from its frame as if created by Task_Create(); only
+  * the frame bytes themselves are written at boot, see static_tasks_init().
+  */
+#define OS_STATIC_PD(f,py,a,size) \
+	[f##_PID] = { .sp = &f##_stack[(size)-1-40], .code = f, .arg = (a), \
+		.priority = (py), .past = NO_PRIORITY, .threshold = NO_PRIORITY, .pid = f##_PID, \
+		.tslot = NO_SLOT, .state = READY },
+#define OS_STATIC_STACK_ENTRY(f,py,arg,size)  { f##_stack, (size) },
+
+/** Stack of each static task, used again if its pid is reused by Task_Create(). */
+static const struct
+{
+	unsigned char* base;
+	unsigned int size;
+} static_stack[] = { OS_STATIC_TASKS(OS_STATIC_STACK_ENTRY) };
+
+volatile static PD Process[MAXPROCESS+KERNEL_PDS] = { OS_STATIC_TASKS(OS_STATIC_PD) };
+#else
+volatile static PD Process[MAXPROCESS+KERNEL_PDS];
+#endif
 volatile static PD* idle_task = &Process[MAXPROCESS];
+/**
+  * Stacks of the dynamic tasks, indexed by pid-OS_STATIC_TASK_COUNT; kept apart
+  * from Process[] so they can go to XMEM.
+  */
+static unsigned char Workspace[MAXPROCESS+1-OS_STATIC_TASK_COUNT][WORKSPACE] WORKSPACE_SECTION;
+#if MAXMUTEX > 0
+#ifdef OS_STATIC_MUTEXES
+#define OS_STATIC_MD(name)   [name] = { .state = FREE },
+volatile static MD Mutex[MAXMUTEX] = { OS_STATIC_MUTEXES(OS_STATIC_MD) };
+#else
 volatile static MD Mutex[MAXMUTEX];
+#endif
+#endif
 
 static queue_t ready_queue[11];
-static queue_t sleep_queue;
+#define WHEEL_SLOTS (1<<WHEEL_BITS)
+/** Sleeping tasks, see wheel_insert(). */
+static volatile PD* wheel[WHEEL_LEVELS*WHEEL_SLOTS];
+/** Tasks whose time ran out in the tick ISR, linked by tnext, for the kernel to wake. */
+static volatile PD* volatile expired_list;
+/** Absolute time in ticks, advanced by wheel_tick(). */
+static volatile TICK os_ticks;
 static queue_t dead_pool_queue;
+/** Suspended tasks; they are in no ready or sleep queue while here. */
+static queue_t suspend_queue;
 static queue_t event_queue[MAXEVENT];
 static int signal[MAXEVENT];
-static uint8_t num_events_created = 0;
+static uint8_t num_events_created = OS_STATIC_EVENT_COUNT;
+#if MSG_PASSING
+static MSGD Msg[MAXPROCESS];
+/** Senders waiting for each task to receive, most urgent first. */
+static queue_t msg_queue[MAXPROCESS];
+#endif
+#if MAXCOND > 0
+static struct
+{
+	unsigned char allocated;
+	unsigned char mutex;       /* the mutex its waiters gave up */
+	queue_t queue;
+} Cond[MAXCOND];
+static volatile COND cond_arg;
+#endif
+#if MAXRWLOCK > 0
+static RWD RWLock[MAXRWLOCK];
+static volatile RWLOCK rwlock_arg;
+#endif
+#if MAXMUTEX > 0
 static volatile MUTEX mutex_unlock_arg;
+#if DEADLOCK_CHECK
+static struct deadlock_report deadlock_report;
+#endif
+#ifdef OS_MUTEX_STATS
+static struct mutex_stat MutexStats[MAXMUTEX];
+/** timer1_now() when the current owner took the mutex. */
+static unsigned long mutex_hold_start[MAXMUTEX];
+#endif
+#endif
+
+/**
+  * Deferred work ring. ISRs are the only producers and do not nest, and the
+  * kernel is the only consumer, so head/tail need no lock: the producer only
+  * writes deferred_tail and the consumer only writes deferred_head.
+  */
+static volatile deferred_work deferred_queue[MAXDEFERRED];
+static volatile uint8_t deferred_head;
+static volatile uint8_t deferred_tail;
+/** Number of work items dropped because the ring was full, stops at 255. */
+static volatile uint8_t deferred_overflow;
+
+#if MAXBASIC > 0
+static BD BasicTask[MAXBASIC];
+static uint8_t num_basic;
+/** The one stack every basic task runs on. */
+static unsigned char BasicStack[BASICSTACK];
+/**
+  * The PD that carries whichever basic task is innermost on BasicStack. Like
+  * the idle task it lies past the task slots and has no Workspace[] entry.
+  */
+static volatile PD* basic_runner = &Process[MAXPROCESS+1];
+/**
+  * Basic tasks started on BasicStack, innermost last. Each entry keeps the
+  * stack pointer of the basic task it preempted, to resume it on completion.
+  */
+static struct
+{
+	uint8_t task;
+	unsigned volatile char* sp;
+} basic_nest[MAXBASIC];
+static uint8_t basic_depth;
+/**
+  * Basic tasks with pending activations, one FIFO per priority linked by
+  * BD::pnext; the head of a list goes to its tail after each run, so equal
+  * priorities take turns.
+  */
+static uint8_t basic_pending_head[MINPRIORITY+1];
+static uint8_t basic_pending_tail[MINPRIORITY+1];
+/** Protothreads waiting on each event, most urgent first, linked by BD::next. */
+static uint8_t pt_event_waiters[MAXEVENT];
+/** Sleeping protothreads, see pt_wheel_insert(). */
+static uint8_t pt_wheel[WHEEL_LEVELS*WHEEL_SLOTS];
+/** Protothreads whose sleep ran out in the tick ISR, linked by BD::next. */
+static volatile uint8_t pt_expired;
+static void basic_exit(void);
+static int basic_activate(BASIC_TASK b);
+#endif
+
+#if MAXTIMER > 0
+volatile static TD Timer[MAXTIMER];
+/** Running timers sorted by expiry; each delta is relative to its predecessor. */
+static volatile TD* timer_list;
+/** Signalled by the tick when the head of timer_list runs out. */
+static EVENT timer_event;
+/** 1 once the first Timer_Create() has taken timer_event and started timer_service(). */
+static uint8_t timer_service_started;
+static void timer_service(void);
+#endif
 
 
 
-//static int max_timer = INT_MAX;
 static uint8_t volatile error_msg;
 
 volatile int preempt=0;
@@ -124,6 +312,12 @@ volatile static unsigned int KernelActive;
 volatile static unsigned int Tasks;  
 
 static volatile create_args kernel_request_create_args;
+/** Parked TaskPool_Acquire() workers, see pool_worker(). */
+static queue_t pool_queue;
+/** CPU cycles of the last Task_Create()/TaskPool_Acquire(), see Task_CreateCycles(). */
+static volatile unsigned long create_cycles;
+/** TIMER1 runs at F_CPU/8, see set_timer(). */
+#define CYCLES_PER_TIMER1_COUNT 8
 
 static void idle (void)
 {
@@ -134,6 +328,8 @@ static void idle (void)
 static void enqueue(queue_t* queue_ptr, volatile PD* task_to_add)
 {
     task_to_add->next = NULL;
+    task_to_add->prev = queue_ptr->tail;
+    task_to_add->queue = queue_ptr;
 
     if(queue_ptr->head == NULL)
     {
@@ -149,88 +345,195 @@ static void enqueue(queue_t* queue_ptr, volatile PD* task_to_add)
     }
 }
 
+/**
+ * @brief Puts a task at the front of a queue, e.g. a preempted task that
+ * should resume before its peers.
+ */
+static void enqueue_front(queue_t* queue_ptr, volatile PD* task_to_add)
+{
+    task_to_add->prev = NULL;
+    task_to_add->next = queue_ptr->head;
+    task_to_add->queue = queue_ptr;
+
+    if(queue_ptr->head == NULL)
+    {
+        queue_ptr->tail = task_to_add;
+    }
+    else
+    {
+        queue_ptr->head->prev = task_to_add;
+    }
+    queue_ptr->head = task_to_add;
+}
 
-static void enqueue_sleep(volatile PD* task_to_add)
+/**
+ * @brief Inserts a task into a wait queue kept in priority order (0 first).
+ * Tasks of equal priority stay FIFO. The scan starts at the tail since a new
+ * waiter most often does not outrank everyone already waiting.
+ */
+static void enqueue_prio(queue_t* queue_ptr, volatile PD* task_to_add)
 {
-	task_to_add->next = NULL;
-	volatile PD *curr;
-	volatile PD *prev;
-	/*
-	int rotations = task_to_add->tick / max_timer;
-	int remainder = task_to_add->tick % max_timer;
-	
-	int curr_rotations = 0;
-	int curr_remainder = 0;
-	*/
-	if(sleep_queue.head == NULL)
-	{
-		sleep_queue.head = task_to_add;
-		sleep_queue.tail = task_to_add;
-	}
-	// not empty
-	else 
-	{		
-		curr=sleep_queue.head;
-		prev=sleep_queue.head;
-		/*
-		curr_rotations = curr->tick/max_timer;
-		curr_remainder = curr->tick % max_timer;
-		*/
-		if(task_to_add->tick < curr->tick)
-		{
-			sleep_queue.head=task_to_add;
-			task_to_add->next=curr;
-			return;
-		}
-		
-		/*else if(rotations==curr_rotations)
-		{
-			if(remainder<curr_remainder)
-			{
-				sleep_queue.head=task_to_add;
-				task_to_add->next=curr;
-			}	
-		}*/
+    volatile PD* after = queue_ptr->tail;
 
-		else
-		{
-			curr = prev->next;
-			while (curr != NULL)
-			{
-				/*
-				curr_rotations = curr->tick/max_timer;
-				curr_remainder = curr->tick % max_timer;
-				*/
-				if (task_to_add->tick<curr->tick)
-				{
-					prev->next = task_to_add;
-					task_to_add->next = curr;   // correction
-
-					return;
-				}
-			/*	else if (rotations == curr_rotations)
-				{
-					if (remainder<curr_remainder)
-					{
-						prev->next = task_to_add;
-						task_to_add->next = curr;   // correction
-
-						return;
-					}
-				}*/
-				prev=prev->next;
-				curr=curr->next;
-			}
-		}
-		prev->next=task_to_add;
-		sleep_queue.tail=task_to_add;
+    while(after != NULL && after->priority > task_to_add->priority)
+    {
+        after = after->prev;
+    }
+    if(after == NULL)
+    {
+        enqueue_front(queue_ptr, task_to_add);
+        return;
+    }
+    task_to_add->prev = after;
+    task_to_add->next = after->next;
+    task_to_add->queue = queue_ptr;
+    if(after->next == NULL)
+    {
+        queue_ptr->tail = task_to_add;
+    }
+    else
+    {
+        after->next->prev = task_to_add;
+    }
+    after->next = task_to_add;
+}
+
+
+/**
+ * @brief Puts a task in the hierarchical timing wheel to expire at an absolute
+ * tick. Level L holds tasks that are less than 1<<(WHEEL_BITS*(L+1)) ticks
+ * away, in the slot picked by the matching bits of the expiry time. Constant
+ * time: no search, just a push on the slot's doubly linked list.
+ */
+static uint8_t wheel_slot(TICK expires)
+{
+	TICK idx = expires - os_ticks;
+	uint8_t level = 0;
+
+	while(level<WHEEL_LEVELS-1 && (idx>>(WHEEL_BITS*(level+1)))!=0){
+		level++;
+	}
+	return level*WHEEL_SLOTS+((expires>>(WHEEL_BITS*level))&(WHEEL_SLOTS-1));
+}
+
+static void wheel_insert(volatile PD* task_to_add, TICK expires)
+{
+	uint8_t slot = wheel_slot(expires);
+
+	task_to_add->tick = expires;
+	task_to_add->tslot = slot;
+	task_to_add->tprev = NULL;
+	task_to_add->tnext = wheel[slot];
+	if(wheel[slot]!=NULL){
+		wheel[slot]->tprev = task_to_add;
 	}
+	wheel[slot] = task_to_add;
+}
 
+/**
+ * @brief Unlinks a task from the timing wheel in constant time.
+ */
+static void wheel_remove(volatile PD* task)
+{
+	if(task->tslot==NO_SLOT){
+		return;
+	}
+	if(task->tprev!=NULL){
+		task->tprev->tnext = task->tnext;
+	}
+	else{
+		wheel[task->tslot] = task->tnext;
+	}
+	if(task->tnext!=NULL){
+		task->tnext->tprev = task->tprev;
+	}
+	task->tnext = NULL;
+	task->tprev = NULL;
+	task->tslot = NO_SLOT;
 }
 
+#if MAXBASIC > 0
+/**
+ * @brief Puts protothread b in pt_wheel, which has the slots of the task
+ * wheel but links BasicTask[] entries by BD::next; a sleeping protothread is
+ * never taken out early, so one link is enough. b must wake after os_ticks.
+ */
+static void pt_wheel_insert(uint8_t b)
+{
+	uint8_t slot = wheel_slot(BasicTask[b].wake);
+
+	BasicTask[b].next = pt_wheel[slot];
+	pt_wheel[slot] = b;
+}
+#endif
 
-		
+/**
+ * @brief Advances the wheel by one tick. Called from the tick ISR.
+ *
+ * When the low bits of the time roll over, the matching slot of the next
+ * level is redistributed into the lower levels. Tasks in the level 0 slot
+ * for this tick are spliced onto expired_list, which the kernel drains.
+ */
+static void wheel_tick(void)
+{
+	uint8_t level;
+	uint8_t slot;
+	volatile PD* curr;
+	volatile PD* next;
+#if MAXBASIC > 0
+	uint8_t b;
+	uint8_t bnext;
+#endif
+
+	++os_ticks;
+	for(level=1;level<WHEEL_LEVELS;level++){
+		if((os_ticks&((1UL<<(WHEEL_BITS*level))-1))!=0){
+			break;
+		}
+		slot = level*WHEEL_SLOTS+((os_ticks>>(WHEEL_BITS*level))&(WHEEL_SLOTS-1));
+		curr = wheel[slot];
+		wheel[slot] = NULL;
+		while(curr!=NULL){
+			next = curr->tnext;
+			wheel_insert(curr,curr->tick);
+			curr = next;
+		}
+#if MAXBASIC > 0
+		b = pt_wheel[slot];
+		pt_wheel[slot] = NO_BASIC;
+		while(b!=NO_BASIC){
+			bnext = BasicTask[b].next;
+			pt_wheel_insert(b);
+			b = bnext;
+		}
+#endif
+	}
 
+	slot = os_ticks&(WHEEL_SLOTS-1);
+	curr = wheel[slot];
+	if(curr!=NULL){
+		next = curr;
+		while(curr->tnext!=NULL){
+			curr->tslot = NO_SLOT;
+			curr = curr->tnext;
+		}
+		curr->tslot = NO_SLOT;
+		curr->tnext = expired_list;
+		expired_list = next;
+		wheel[slot] = NULL;
+	}
+#if MAXBASIC > 0
+	b = pt_wheel[slot];
+	if(b!=NO_BASIC){
+		while(BasicTask[b].next!=NO_BASIC){
+			b = BasicTask[b].next;
+		}
+		BasicTask[b].next = pt_expired;
+		pt_expired = pt_wheel[slot];
+		pt_wheel[slot] = NO_BASIC;
+	}
+#endif
+}
 
 /**
  * @brief Pops head of queue and returns it.
@@ -242,68 +545,102 @@ static volatile PD* dequeue(queue_t* queue_ptr)
 {
     volatile PD* task_ptr = queue_ptr->head;
 
-    if(queue_ptr->head != NULL)
+    if(task_ptr != NULL)
     {
-		 if (queue_ptr->head==queue_ptr->tail){
-			queue_ptr->head =NULL;
-			queue_ptr->tail =NULL;
-		 }
-		 else{
-        queue_ptr->head = queue_ptr->head->next;
-		 }
+        queue_ptr->head = task_ptr->next;
+        if(queue_ptr->head == NULL)
+        {
+            queue_ptr->tail = NULL;
+        }
+        else
+        {
+            queue_ptr->head->prev = NULL;
+        }
         task_ptr->next = NULL;
+        task_ptr->prev = NULL;
+        task_ptr->queue = NULL;
     }
 
     return task_ptr;
 }
 
-static volatile PD* dequeue_from_ready(queue_t* queue_ptr)
+/**
+ * @brief Unlinks a task from whichever queue it is in, in constant time.
+ *
+ * @param task the task descriptor to remove
+ * @return 1 if the task was in a queue, 0 otherwise
+ */
+static int dequeue_task(volatile PD* task)
 {
-	volatile PD* current = queue_ptr->head;
-	volatile PD* prev = queue_ptr->head;
+	queue_t* queue_ptr = task->queue;
 
-
-	
-	if(queue_ptr->head != NULL)
-	{
-		if (current->suspend==0){
-				if (queue_ptr->tail==queue_ptr->head){
-					queue_ptr->tail=NULL;
-					queue_ptr->head=NULL;
-				}
-				else{
-					queue_ptr->head=current->next;
-				}
-			current->next=NULL;
-			return current;
-		}
-		
-		current=prev->next;
-		while(current!=NULL){
-			if(current->suspend==0){
-				if (queue_ptr->tail==current){
-					queue_ptr->tail=prev;
-				}
-				prev->next=current->next;
-				current->next=NULL;
-				return current;
-			}
-			prev=prev->next;
-			current=current->next;
-		}
+	if(queue_ptr==NULL){
+		return 0;
 	}
-	error_msg=ERR_3_NO_SUCH_TASK;
-	OS_Abort();
-	return current;
-	//Error nothing valid in queue
-
+	if(task->prev==NULL){
+		queue_ptr->head=task->next;
+	}
+	else{
+		task->prev->next=task->next;
+	}
+	if(task->next==NULL){
+		queue_ptr->tail=task->prev;
+	}
+	else{
+		task->next->prev=task->prev;
+	}
+	task->next=NULL;
+	task->prev=NULL;
+	task->queue=NULL;
+	return 1;
 }
 
+/**
+ * @brief Writes an initial context frame so that a switch to it starts f,
+ * and returning from f lands in on_exit.
+ *
+ * Only these 40 bytes are written; the rest of the stack is left as it is.
+ *
+ * @param sp the highest free byte of the stack
+ * @return the stack pointer to store in the PD
+ */
+static unsigned char* init_frame(unsigned char* sp, voidfuncptr f, voidfuncptr on_exit)
+{
+   //Notice that we are placing the address (16-bit) of the functions
+   //onto the stack in reverse byte order (least significant first, followed
+   //by most significant).  This is because the "return" assembly instructions 
+   //(rtn and rti) pop addresses off in BIG ENDIAN (most sig. first, least sig. 
+   //second), even though the AT90 is LITTLE ENDIAN machine.
 
+   //Store terminate at the bottom of stack to protect against stack underrun.
+   *(unsigned char *)sp-- = ((unsigned int)on_exit) & 0xff;
+   *(unsigned char *)sp-- = (((unsigned int)on_exit) >> 8) & 0xff;
+	*(unsigned char *)sp-- = 0x00;
 
+   //Place return address of function at bottom of stack
+   *(unsigned char *)sp-- = ((unsigned int)f) & 0xff;
+   *(unsigned char *)sp-- = (((unsigned int)f) >> 8) & 0xff;
+	*(unsigned char *)sp-- = 0x00;
 
+	//The 34 saved registers start out zero; EIND and SREG among them must.
+	memset(sp-33,0,34);
+	return sp - 34;
+}
 
-
+/**
+ * The stack of p and its size in bytes.
+ */
+static unsigned char* task_stack(volatile PD* p, unsigned int* size)
+{
+#ifdef OS_STATIC_TASKS
+	if (p->pid < OS_STATIC_TASK_COUNT){
+		*size = static_stack[p->pid].size;
+		return static_stack[p->pid].base;
+	}
+#endif
+	*size = WORKSPACE;
+	return Workspace[p->pid-OS_STATIC_TASK_COUNT];
+}
 
 /**
  * When creating a new task, it is important to initialize its stack just like
@@ -314,41 +651,36 @@ static volatile PD* dequeue_from_ready(queue_t* queue_ptr)
 static void Kernel_Create_Task_At(volatile PD *p, voidfuncptr f , PRIORITY py, int arg) 
 {   
    unsigned char *sp;
+   unsigned char *stack;
+   unsigned int size;
+
+   stack = task_stack(p,&size);
    //Changed -2 to -1 to fix off by one error.s
-   sp = (unsigned char *) &(p->workSpace[WORKSPACE-1]);
+   sp = &stack[size-1];
 
 
 
    /*----BEGIN of NEW CODE----*/
    //Initialize the workspace (i.e., stack) and PD here!
 
-   //Clear the contents of the workspace
-   memset(&(p->workSpace),0,WORKSPACE);
-
-   //Notice that we are placing the address (16-bit) of the functions
-   //onto the stack in reverse byte order (least significant first, followed
-   //by most significant).  This is because the "return" assembly instructions 
-   //(rtn and rti) pop addresses off in BIG ENDIAN (most sig. first, least sig. 
-   //second), even though the AT90 is LITTLE ENDIAN machine.
-
-   //Store terminate at the bottom of stack to protect against stack underrun.
-   *(unsigned char *)sp-- = ((unsigned int)Task_Terminate) & 0xff;
-   *(unsigned char *)sp-- = (((unsigned int)Task_Terminate) >> 8) & 0xff;
-	*(unsigned char *)sp-- = 0x00;
-
-   //Place return address of function at bottom of stack
-   *(unsigned char *)sp-- = ((unsigned int)f) & 0xff;
-   *(unsigned char *)sp-- = (((unsigned int)f) >> 8) & 0xff;
-	*(unsigned char *)sp-- = 0x00;
-
-	sp = sp - 34;
-   p->sp = sp;		/* stack pointer into the "workSpace" */
+   //Only the initial frame is written, the workspace is not cleared.
+#ifdef OS_STACK_CANARY
+   stack[0] = STACK_CANARY;
+   stack[1] = STACK_CANARY;
+#endif
+   sp = init_frame(sp,f,Task_Terminate);
+   p->sp = sp;		/* stack pointer into the workspace */
    p->code = f;		/* function to be executed as a task */
    p->request = NONE;
 	p->arg= arg;
 	p->priority=py;
-	p->past=-1;
+	p->past=NO_PRIORITY;
+	p->threshold=NO_PRIORITY;
+	p->notify=0;
+	p->notify_mask=0;
 	p->suspend=0;
+	p->tick=0;
+	p->tslot=NO_SLOT;
    /*----END of NEW CODE----*/
 	
 
@@ -384,6 +716,95 @@ static PID Kernel_Create_Task( voidfuncptr f , PRIORITY py, int arg)
    return p->pid;
 }
 
+/**
+  * TIMER1 counts since start. TIMER1 restarts at OCR1A every tick, so this is
+  * only right for spans shorter than a tick.
+  */
+static unsigned int timer1_since(unsigned int start)
+{
+	unsigned int now = TCNT1;
+
+	return (now >= start) ? now - start : now + OCR1A + 1 - start;
+}
+
+#ifdef OS_MUTEX_STATS
+/**
+  * TIMER1 counts since OS_Start(), from os_ticks and TCNT1; wraps after about
+  * 35 minutes, which differences of a few seconds do not mind. Call with
+  * interrupts off.
+  */
+static unsigned long timer1_now(void)
+{
+	TICK t = os_ticks;
+	unsigned int c = TCNT1;
+
+	if (TIFR1 & (1<<OCF1A)){
+		/* the counter restarted but the tick ISR has not run yet */
+		++t;
+		c = TCNT1;
+	}
+	return t * (OCR1A + 1UL) + c;
+}
+
+/**
+  * p now owns m. If it had to wait, p->tick holds when it blocked: a BLOCKED
+  * task is in no timing wheel slot, so the field is free until it runs.
+  */
+static void stat_acquired(MUTEX m, volatile PD* p, int contended)
+{
+	struct mutex_stat* s = &MutexStats[m];
+	unsigned long now = timer1_now();
+
+	++s->acquisitions;
+	if (contended){
+		unsigned long wait = now - p->tick;
+
+		++s->contended;
+		s->wait_total += wait;
+		if (wait > s->wait_max){
+			s->wait_max = wait;
+		}
+		p->tick = 0;
+	}
+	mutex_hold_start[m] = now;
+}
+
+/**
+  * owner gives up m, by the unlock that matches its first lock.
+  */
+static void stat_released(MUTEX m, volatile PD* owner)
+{
+	struct mutex_stat* s = &MutexStats[m];
+	unsigned long hold = timer1_now() - mutex_hold_start[m];
+
+	s->hold_total += hold;
+	if (hold > s->hold_max){
+		s->hold_max = hold;
+		s->max_holder = owner->pid;
+	}
+}
+#endif
+
+#ifdef OS_STACK_CANARY
+/**
+  * Abort if p has run past the bottom of its stack.
+  */
+static void stack_check(volatile PD* p)
+{
+	unsigned char* stack;
+	unsigned int size;
+
+#if MAXBASIC > 0
+	if (p == basic_runner) return;	/* runs on BasicStack */
+#endif
+	stack = task_stack(p,&size);
+	if (p->sp < stack || stack[0] != STACK_CANARY || stack[1] != STACK_CANARY){
+		error_msg=FAIL_1_STACK_OVERFLOW;
+		OS_Abort();
+	}
+}
+#endif
+
 
 /**
   * This internal kernel function is a part of the "scheduler". It chooses the 
@@ -398,65 +819,140 @@ static void Dispatch()
 	  //in 10 ready queues
 	 
 	int i;
-	int found=0;
-	volatile PD* current;
-	//while(Cp->state!=RUNNING){
 		
 	if(Cp->state != RUNNING || Cp == idle_task)
 	{
-			for (i=0;i<11;i++){
-				current=ready_queue[i].head;
-				while(current!=NULL){
-					if(!current->suspend){
-						Cp=dequeue_from_ready(&ready_queue[i]);
-						CurrentSp = Cp->sp;
-						Cp->state = RUNNING;
-						found=1;
-						Enable_Interrupt();
-						break;
-					}
-					current=current->next;
-				}
-	
-			if (found){
-				break;
+		/* suspended tasks are never in a ready queue, so the first head wins */
+		for (i=0;i<11;i++){
+			if(ready_queue[i].head!=NULL){
+				Cp=dequeue(&ready_queue[i]);
+				CurrentSp = Cp->sp;
+				Cp->state = RUNNING;
+				return;
 			}
 		}
-		if(!found){
-			Cp=idle_task;
-			
-		}
+		Cp=idle_task;
 	}
-	
+}
 
+/**
+  * The ready level p holds while it runs: its priority, or its preemption
+  * threshold if that is more urgent. A task preempted at that level goes back
+  * to the front of it, so it still runs before the tasks its threshold keeps
+  * out.
+  */
+static PRIORITY run_level(volatile PD* p)
+{
+	return (p->threshold<p->priority) ? p->threshold : p->priority;
 }
 
+/**
+  * Is a task ready that may preempt Cp? Not while the scheduler is locked;
+  * the preemption is then only noted for Sched_Unlock().
+  */
 int check_rqueue(){
-	volatile PD* current;
 	int i;
-	for(i=0;i<Cp->priority;i++){	
-		
+	for(i=0;i<run_level(Cp);i++){	
 		if(ready_queue[i].head!=NULL){
-			
-			current=ready_queue[i].head;
-			while(current!=NULL){
-				if(!current->suspend){
-					return 1;
-				}
-				current=current->next;
+			if(sched_lock){
+				sched_pending=1;
+				return 0;
 			}
-			
+			return 1;
 		}
 	}
 	return 0;
 }
 
+/**
+ * @brief Runs p next, straight from its ready queue, unless a more urgent
+ * task is ready. Cp must already be off the CPU (requeued or blocked).
+ *
+ * @return 1 if p is now Cp, 0 if Dispatch() has to choose
+ */
+static int handoff(volatile PD* p)
+{
+	int i;
+
+	if(p->state!=READY){
+		return 0;
+	}
+	for(i=0;i<p->priority;i++){
+		if(ready_queue[i].head!=NULL){
+			return 0;
+		}
+	}
+	dequeue_task(p);
+	Cp=p;
+	CurrentSp=Cp->sp;
+	Cp->state=RUNNING;
+	return 1;
+}
+
+/**
+ * @brief Moves a task that was just released (woken, signalled, granted a mutex)
+ * to its ready queue, or to the suspended list if it was suspended while it waited.
+ */
+static void make_ready(volatile PD* p)
+{
+	if(p->suspend){
+		p->state=SUSPENDED;
+		enqueue(&suspend_queue,p);
+	}
+	else{
+		p->state=READY;
+		enqueue(&ready_queue[p->priority],p);
+	}
+}
+
+/**
+  * Body of every TaskPool_Acquire() task. PD::code holds the job, not this
+  * function; when the job returns the task parks in pool_queue with its stack
+  * as it is, and the next TaskPool_Acquire() just hands it a new job.
+  */
+static void pool_worker(void)
+{
+	uint8_t sreg;
+
+	for(;;){
+		Cp->code();
+		sreg=SREG;
+		Disable_Interrupt();
+		Cp->request=POOL_PARK;
+		Enter_Kernel();
+		SREG=sreg;
+	}
+}
+
+/**
+  * Give f to a parked pool worker, or make a new worker if none is parked.
+  */
+static PID pool_acquire(voidfuncptr f, PRIORITY py, int arg)
+{
+	volatile PD* p = dequeue(&pool_queue);
+
+	if (p == NULL){
+		p = &Process[Kernel_Create_Task(pool_worker,py,arg)];
+	}
+	else{
+		p->arg=arg;
+		p->priority=py;
+		p->past=NO_PRIORITY;
+		p->threshold=NO_PRIORITY;
+		p->notify=0;
+		p->notify_mask=0;
+		make_ready(p);
+	}
+	p->code=f;
+	return p->pid;
+}
+
 static void kernel_event_wait(void)
 {
 	/* Check the handle of the event to ensure that it is initialized. */
 	uint16_t handle = ((uint16_t)(*kernel_request_event_ptr));
 
-	if((uint8_t) handle> num_events_created)
+	if((uint8_t) handle>= num_events_created)
 	{
 		//no such event
 		OS_Abort();
@@ -468,17 +964,19 @@ static void kernel_event_wait(void)
 	{
 		/* Place this task in a queue. */
 		Cp->state = WAITING;
-		enqueue(&event_queue[handle],Cp);
+		enqueue_prio(&event_queue[handle],Cp);
 		Dispatch();
 	}
 }
 
-static void kernel_event_signal()
+/**
+ * @brief Signals an event without rescheduling.
+ *
+ * @return 1 if a waiting task was made ready, 0 otherwise
+ */
+static int event_signal(uint16_t handle)
 {
-	/* Check the handle of the event to ensure that it is initialized. */
-	uint16_t handle =((uint16_t)(*kernel_request_event_ptr) );
-
-	if((uint8_t) handle> num_events_created)
+	if((uint8_t) handle>= num_events_created)
 	{
 // No such Task
 		OS_Abort();
@@ -489,68 +987,512 @@ static void kernel_event_signal()
 		{
 			/* The signalled task */
 			volatile PD* task_ptr = dequeue(&event_queue[handle]);
-			event_queue[handle].head = NULL;
-			event_queue[handle].tail = NULL;
-			task_ptr->state =RUNNING;
-			enqueue(&ready_queue[task_ptr->priority],task_ptr);
-			preemption();
-			
+			make_ready(task_ptr);
+			return 1;
+		}
+#if MAXBASIC > 0
+		else if(pt_event_waiters[handle]!=NO_BASIC){
+			/* no task is waiting, but a protothread is */
+			uint8_t b=pt_event_waiters[handle];
+			pt_event_waiters[handle]=BasicTask[b].next;
+			BasicTask[b].wait=PT_NONE;
+			return basic_activate(b);
 		}
+#endif
 		else{
 			signal[handle]=1;	
 		}
 	}
+	return 0;
+}
+
+static void kernel_event_signal()
+{
+	/* Check the handle of the event to ensure that it is initialized. */
+	uint16_t handle =((uint16_t)(*kernel_request_event_ptr) );
+
+	if(event_signal(handle)){
+		preemption();
+	}
 }
 
 
 void preemption(){
 	if(check_rqueue()){
-		Cp->state=READY;
-		//enqueue(&ready_queue[Cp->priority],Cp);
-		
-		Cp->next = ready_queue[Cp->priority].head;
-		ready_queue[Cp->priority].head = Cp;
+		if(Cp!=idle_task){
+			Cp->state=READY;
+			enqueue_front(&ready_queue[run_level(Cp)],Cp);
+		}
 		
 		Dispatch();
 	}
 }
 
-static volatile PD* find_in_ready(PID pid){
-	int i;
-	
-	volatile PD* curr;
-	volatile PD* prev;
-	for (i=0;i<11;i++){
-		curr= ready_queue[i].head;
-		if (curr->pid==pid){
-			ready_queue[i].head=curr->next;
-			if (ready_queue[i].head==ready_queue[i].tail) {
-				ready_queue[i].head=NULL;
-				ready_queue[i].tail=NULL;
-			}
-			curr->next =NULL;
-			return curr;
+/**
+ * @brief Moves a task to the place its current priority calls for: another
+ * ready level if it is READY, or a new position in its priority-ordered wait
+ * queue if it is blocked on a mutex or waiting on an event.
+ */
+static void reposition(volatile PD* p)
+{
+	queue_t* queue_ptr = p->queue;
+
+	if(queue_ptr==NULL){
+		return;
+	}
+	dequeue_task(p);
+	if(p->state==READY){
+		enqueue(&ready_queue[p->priority],p);
+	}
+	else if(p->state==BLOCKED||p->state==WAITING){
+		enqueue_prio(queue_ptr,p);
+	}
+	else{
+		enqueue(queue_ptr,p);
+	}
+}
+
+/**
+  * Priority inheritance: raise holder, which waiter is blocked on, to the
+  * priority of waiter if that is higher. The priority before the first raise
+  * is kept in past, to be restored by disinherit().
+  */
+static void inherit(volatile PD* holder, volatile PD* waiter)
+{
+	if(holder->priority>waiter->priority){
+		if(holder->past==NO_PRIORITY){
+			holder->past=holder->priority;
+		}
+		holder->priority=waiter->priority;
+		//moves the holder up a ready level, or up its own wait queue
+		reposition(holder);
+	}
+}
+
+/**
+  * Drop what p inherited, when it gives up the lock it was raised for.
+  */
+static void disinherit(volatile PD* p)
+{
+	if(p->past!=NO_PRIORITY){
+		p->priority=p->past;
+		p->past=NO_PRIORITY;
+	}
+}
+
+static void reinherit(volatile PD* p);
+
+/**
+  * The priority p was given, as opposed to the one it runs at (PD::priority),
+  * which may be inherited.
+  */
+static PRIORITY base_priority(volatile PD* p)
+{
+	return (p->past==NO_PRIORITY) ? p->priority : p->past;
+}
+
+/**
+ * @brief Looks up a task by PID. If it does not name a live task, reports
+ * ERR_3_NO_SUCH_TASK and returns NULL: that error is recoverable, so
+ * OS_Abort() comes back and every caller must leave the request undone.
+ */
+static volatile PD* lookup_task(PID pid)
+{
+	if(pid>=MAXPROCESS||Process[pid].state==DEAD){
+		error_msg=ERR_3_NO_SUCH_TASK;
+		OS_Abort();
+		return NULL;
+	}
+	return &Process[pid];
+}
+
+/**
+ * @brief Takes a task out of the ready or sleep queue and parks it on the
+ * suspended list. A sleeping task keeps its remaining ticks in PD::tick.
+ * Tasks that are WAITING or BLOCKED stay in their event/mutex queue with the
+ * suspend flag set; make_ready() diverts them here when they are released.
+ */
+static void suspend_task(volatile PD* p)
+{
+	if(p->suspend){
+		return;
+	}
+	p->suspend=1;
+
+	if(p==Cp){
+		Cp->state=SUSPENDED;
+		enqueue(&suspend_queue,Cp);
+		Dispatch();
+	}
+	else if(p->state==READY){
+		dequeue_task(p);
+		p->state=SUSPENDED;
+		enqueue(&suspend_queue,p);
+	}
+	else if(p->state==SLEEPING){
+		/* keep only the ticks still owed; 1 at least, since it has not expired */
+		p->tick=TICK_AFTER(p->tick,os_ticks)?p->tick-os_ticks:1;
+		wheel_remove(p);
+		p->state=SUSPENDED;
+		enqueue(&suspend_queue,p);
+	}
+}
+
+static void kernel_suspend(void)
+{
+	volatile PD* p = lookup_task(kernel_request_pid);
+
+	if(p!=NULL){
+		suspend_task(p);
+	}
+}
+
+/**
+ * @brief Clears the suspend flag and, if the task is on the suspended list,
+ * returns it to the sleep queue (ticks still owed) or its ready queue.
+ */
+static int resume_task(volatile PD* p)
+{
+	if(!p->suspend){
+		return 0;
+	}
+	p->suspend=0;
+
+	if(p->state==SUSPENDED){
+		dequeue_task(p);
+		if(p->tick>0){
+			p->state=SLEEPING;
+			wheel_insert(p,os_ticks+p->tick);
 		}
 		else{
-			prev=curr;
-			curr=prev->next;
-			while (curr!=NULL){
-				if  (curr->pid==pid){
-						prev->next=curr->next;
-						if(curr==ready_queue[i].tail){
-							ready_queue[i].tail=prev;
-						}
-						curr->next=NULL;
-						return curr;
-				}
-				prev=prev->next;
-				curr=curr->next;
+			p->state=READY;
+			enqueue(&ready_queue[p->priority],p);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void kernel_resume(void)
+{
+	volatile PD* p = lookup_task(kernel_request_pid);
+
+	if(p!=NULL&&resume_task(p)){
+		preemption();
+	}
+}
+
+/**
+ * @brief Moves every sleeper the wheel has expired to the ready queue.
+ *
+ * @return 1 if any task was made ready
+ */
+static int kernel_wake(void)
+{
+	int woken=0;
+	volatile PD* p;
+	while(expired_list!=NULL){
+		p = expired_list;
+		expired_list = p->tnext;
+		p->tnext = NULL;
+		p->tick = 0;
+		if(p->state==SLEEPING){
+			make_ready(p);
+			woken=1;
+		}
+		else if(p->state==WAITING&&p->notify_mask){
+			/* Task_NotifyWait() timed out */
+			p->notify_mask=0;
+			make_ready(p);
+			woken=1;
+		}
+	}
+	return woken;
+}
+
+/**
+  * Apply a notification to p. Returns 1 if p waits for one of the bits that
+  * are set now, so the kernel has to wake it. Call with interrupts off.
+  */
+static int notify_update(volatile PD* p, unsigned char bits, NOTIFY_ACTION action)
+{
+	switch(action){
+	case NOTIFY_SET_BITS:
+		p->notify|=bits;
+		break;
+	case NOTIFY_INCREMENT:
+		if(p->notify!=0xFF){
+			++p->notify;
+		}
+		break;
+	case NOTIFY_OVERWRITE:
+		p->notify=bits;
+		break;
+	}
+	return (p->notify&p->notify_mask)!=0;
+}
+
+/**
+  * Wake p out of Task_NotifyWait(), unless that already happened.
+  */
+static int notify_wake(volatile PD* p)
+{
+	if(p->state!=WAITING||!(p->notify&p->notify_mask)){
+		return 0;
+	}
+	p->notify_mask=0;
+	if(p->tslot!=NO_SLOT){
+		wheel_remove(p);
+	}
+	p->tick=0;
+	make_ready(p);
+	return 1;
+}
+
+#if MAXBASIC > 0
+/**
+ * @brief Starts basic task b on the shared stack, on top of whatever basic
+ * task is running there, and gives basic_runner its priority.
+ */
+static void basic_start(uint8_t b)
+{
+	unsigned char* top;
+
+	if(basic_depth==0){
+		top=&BasicStack[BASICSTACK-1];
+	}
+	else{
+		/* the preempted basic task's context ends just above its saved sp */
+		top=(unsigned char*)basic_runner->sp;
+	}
+	basic_nest[basic_depth].task=b;
+	basic_nest[basic_depth].sp=basic_runner->sp;
+	++basic_depth;
+
+	basic_runner->sp=init_frame(top,BasicTask[b].code,basic_exit);
+	basic_runner->priority=BasicTask[b].priority;
+	if(basic_runner->state==WAITING){
+		basic_runner->state=READY;
+		enqueue(&ready_queue[basic_runner->priority],basic_runner);
+	}
+	else{
+		reposition(basic_runner);
+	}
+}
+
+/**
+ * @brief Appends b to the pending list of its priority.
+ */
+static void basic_queue(uint8_t b)
+{
+	PRIORITY py=BasicTask[b].priority;
+
+	BasicTask[b].pnext=NO_BASIC;
+	if(basic_pending_head[py]==NO_BASIC){
+		basic_pending_head[py]=b;
+	}
+	else{
+		BasicTask[basic_pending_tail[py]].pnext=b;
+	}
+	basic_pending_tail[py]=b;
+}
+
+/**
+ * @brief Counts one more activation of b; b joins its pending list if it had
+ * none.
+ */
+static void basic_pend(uint8_t b)
+{
+	if(BasicTask[b].pending++==0){
+		basic_queue(b);
+	}
+}
+
+/**
+ * @brief Starts the most urgent pending basic task if it outranks the one
+ * on the shared stack (any, if the stack is empty). It leaves the head of
+ * its pending list, and goes back to the tail if it has more activations.
+ *
+ * @return 1 if one was started, so a reschedule is due
+ */
+static int basic_schedule(void)
+{
+	PRIORITY limit=basic_depth?BasicTask[basic_nest[basic_depth-1].task].priority:MINPRIORITY+1;
+	PRIORITY py;
+	uint8_t b;
+
+	for(py=0;py<limit;py++){
+		b=basic_pending_head[py];
+		if(b!=NO_BASIC){
+			basic_pending_head[py]=BasicTask[b].pnext;
+			if(--BasicTask[b].pending!=0){
+				basic_queue(b);
 			}
+			basic_start(b);
+			return 1;
 		}
-		
 	}
-	return NULL;
+	return 0;
+}
+
+/**
+ * @brief Activates a basic task: it starts at once if it outranks the basic
+ * task on the shared stack, otherwise it is counted as pending.
+ *
+ * @return 1 if the runner was made ready or raised, so a reschedule is due
+ */
+static int basic_activate(BASIC_TASK b)
+{
+	if(b>=num_basic){
+		error_msg=ERR_3_NO_SUCH_TASK;
+		OS_Abort();
+		return 0;
+	}
+	basic_pend(b);
+	return basic_schedule();
+}
+
+/**
+ * @brief Files a protothread that just returned under what it is waiting
+ * for, or counts it as pending again if it only yielded or its event has
+ * already been signalled.
+ */
+static void pt_park(uint8_t b)
+{
+	uint8_t* link;
+
+	switch(BasicTask[b].wait){
+	case PT_EVENT:
+		if(signal[BasicTask[b].event]){
+			signal[BasicTask[b].event]=0;
+			BasicTask[b].wait=PT_NONE;
+			basic_pend(b);
+			break;
+		}
+		link=&pt_event_waiters[BasicTask[b].event];
+		while(*link!=NO_BASIC&&BasicTask[*link].priority<=BasicTask[b].priority){
+			link=&BasicTask[*link].next;
+		}
+		BasicTask[b].next=*link;
+		*link=b;
+		break;
+	case PT_SLEEP:
+		if(TICK_BEFORE(os_ticks,BasicTask[b].wake)){
+			pt_wheel_insert(b);
+			break;
+		}
+		/* the sleep ran out while it was still running */
+		BasicTask[b].wait=PT_NONE;
+		basic_pend(b);
+		break;
+	case PT_YIELDED:
+		BasicTask[b].wait=PT_NONE;
+		basic_pend(b);
+		break;
+	}
+}
+
+/**
+ * @brief Activates every protothread the wheel has expired.
+ *
+ * @return 1 if a reschedule is due
+ */
+static int pt_wake(void)
+{
+	int readied=0;
+	uint8_t b;
+
+	while(pt_expired!=NO_BASIC){
+		b=pt_expired;
+		pt_expired=BasicTask[b].next;
+		BasicTask[b].wait=PT_NONE;
+		readied|=basic_activate(b);
+	}
+	return readied;
+}
+
+/**
+ * @brief The innermost basic task has returned: drop its frame, resume the
+ * one it preempted (or park the runner) and start the next pending one.
+ */
+static void kernel_basic_done(void)
+{
+	--basic_depth;
+	pt_park(basic_nest[basic_depth].task);
+	basic_runner->sp=basic_nest[basic_depth].sp;
+	if(basic_depth){
+		basic_runner->priority=BasicTask[basic_nest[basic_depth-1].task].priority;
+	}
+
+	basic_schedule();
+	if(basic_depth==0){
+		basic_runner->state=WAITING;
+		Dispatch();
+	}
+	else{
+		/* still Cp: let anything now outranking it in */
+		preemption();
+	}
+}
+
+/**
+ * Basic tasks return here, on the shared stack, when they complete.
+ */
+static void basic_exit(void)
+{
+	Disable_Interrupt();
+	Cp->request = BASIC_DONE;
+	Enter_Kernel();
+}
+#endif
+
+/**
+ * @brief Applies every work item ISRs have posted since the last kernel entry,
+ * then makes a single rescheduling decision for the whole batch.
+ */
+static void kernel_run_deferred(void)
+{
+	int readied=0;
+	volatile deferred_work* w;
+
+	while(deferred_head!=deferred_tail){
+		w=&deferred_queue[deferred_head];
+		switch(w->type){
+		case DEFER_SIGNAL:
+			readied|=event_signal(w->arg);
+			break;
+		case DEFER_RESUME:
+			if(lookup_task(w->arg)!=NULL){
+				readied|=resume_task(&Process[w->arg]);
+			}
+			break;
+		case DEFER_CALLBACK:
+			w->callback(w->arg);
+			break;
+#if MAXBASIC > 0
+		case DEFER_ACTIVATE:
+			readied|=basic_activate(w->arg);
+			break;
+#endif
+		case DEFER_NOTIFY:
+			readied|=notify_wake(&Process[w->arg]);
+			break;
+#if TASK_BUDGETS
+		case DEFER_THROTTLE:
+			readied|=budget_throttle(&Process[w->arg]);
+			break;
+		case DEFER_REPLENISH:
+			readied|=budget_replenish(&Process[w->arg]);
+			break;
+#endif
+		}
+		deferred_head=(deferred_head+1)%MAXDEFERRED;
+	}
+	if(readied){
+		preemption();
+	}
 }
+
 /**
   * This internal kernel function is the "main" driving loop of this full-served
   * model architecture. Basically, on OS_Start(), the kernel repeatedly
@@ -559,21 +1501,653 @@ static volatile PD* find_in_ready(PID pid){
   *
   * This is the main loop of our kernel, called by OS_Start().
   */
+#if MAXMUTEX > 0 && DEADLOCK_CHECK
+/**
+  * Would Cp waiting for mutex m deadlock? Follows owner -> mutex it is
+  * BLOCKED on -> owner ... from m. Every hop is a different mutex, so it
+  * stops after MAXMUTEX hops at most. On a cycle back to Cp, records it in
+  * deadlock_report and returns 1.
+  */
+static int deadlock_cycle(MUTEX m)
+{
+	volatile PD* p = Cp;
+	uint8_t n;
+
+	for (n = 0; n < MAXMUTEX; n++){
+		deadlock_report.pid[n] = p->pid;
+		deadlock_report.mutex[n] = m;
+		p = Mutex[m].owner;
+		if (p == Cp){
+			deadlock_report.length = n + 1;
+			return 1;
+		}
+		if (p->state != BLOCKED){
+			return 0;
+		}
+		/* a BLOCKED task's queue is the mutex_queue of the mutex it waits for,
+		   unless it waits for a reader-writer lock */
+		for (m = 0; m < MAXMUTEX && &Mutex[m].mutex_queue != p->queue; m++)
+			;
+		if (m == MAXMUTEX){
+			return 0;
+		}
+	}
+	return 0;
+}
+#endif
+
+#if MAXMUTEX > 0
+/**
+  * The owner of m gives it up for good: hand it to the first waiter, which
+  * inherits the priority of the most urgent task still waiting (the queue is
+  * ordered), or free it. Returns 1 if a waiter was made ready.
+  */
+static int mutex_release(MUTEX m)
+{
+	volatile PD* owner=Mutex[m].owner;
+	volatile PD* p;
+
+#ifdef OS_MUTEX_STATS
+	stat_released(m,owner);
+#endif
+	disinherit(owner);
+	p=dequeue(&Mutex[m].mutex_queue);
+	if(p==NULL){
+		Mutex[m].state=FREE;
+		Mutex[m].count=0;
+		reinherit(owner);
+		return 0;
+	}
+	if(Mutex[m].mutex_queue.head!=NULL){
+		inherit(p,Mutex[m].mutex_queue.head);
+	}
+#ifdef OS_MUTEX_STATS
+	stat_acquired(m,p,1);
+#endif
+	Mutex[m].owner=p;
+	/* keep what the old owner inherits through the locks it still holds */
+	reinherit(owner);
+	make_ready(p);
+	return 1;
+}
+
+/**
+  * One Mutex_Unlock() by Cp. Returns 1 if a waiter was made ready.
+  */
+static int mutex_unlock(MUTEX m)
+{
+	if(m>=MAXMUTEX){
+		error_msg=ERR_4_NO_SUCH_MUTEX;
+		OS_Abort();
+		return 0;
+	}
+	if(Mutex[m].owner!=Cp){
+		error_msg= FAIL_2_DEADLOCK;
+		OS_Abort();
+		return 0;
+	}
+	if(Mutex[m].state==LOCKED&&Mutex[m].count>1){
+		--Mutex[m].count;
+		return 0;
+	}
+	return mutex_release(m);
+}
+#endif
+
+#if MAXCOND > 0
+/**
+  * Move the first waiter of c over to its mutex: it owns the mutex at once if
+  * that is free, else it is BLOCKED on it like any Mutex_Lock() caller, so
+  * Cond_Wait() always returns with the mutex held. Returns 0 if nobody
+  * waited, else 1.
+  */
+static int cond_wake(COND c)
+{
+	MUTEX m = Cond[c].mutex;
+	volatile PD* p = dequeue(&Cond[c].queue);
+
+	if(p==NULL){
+		return 0;
+	}
+	if(Mutex[m].state==FREE){
+		Mutex[m].state=LOCKED;
+		Mutex[m].owner=p;
+		Mutex[m].count=1;
+#ifdef OS_MUTEX_STATS
+		stat_acquired(m,p,0);
+#endif
+		make_ready(p);
+	}
+	else{
+		p->state=BLOCKED;
+#ifdef OS_MUTEX_STATS
+		p->tick=timer1_now();
+#endif
+		enqueue_prio(&Mutex[m].mutex_queue,p);
+		inherit(Mutex[m].owner,p);
+	}
+	return 1;
+}
+#endif
+
+#if MSG_PASSING
+/**
+  * Copy the request of sender s into the buffer of receiver r, who goes on
+  * to serve it; s now waits for the reply.
+  */
+static void msg_deliver(volatile PD* s, volatile PD* r)
+{
+	MSGD* m = &Msg[s->pid];
+	MSGD* rm = &Msg[r->pid];
+
+	if (rm->len > m->len){
+		rm->len = m->len;
+	}
+	memcpy(rm->buf,m->buf,rm->len);
+	rm->partner = s->pid;
+	rm->state = MSG_IDLE;
+	m->partner = r->pid;
+	m->state = MSG_REPLY_WAIT;
+	s->state = WAITING;
+}
+
+static void kernel_msg_send(void)
+{
+	volatile PD* r = lookup_task(kernel_request_pid);
+
+	if (r == NULL){
+		Msg[Cp->pid].partner = MAXPROCESS;	/* Msg_Send() returns -1 */
+		return;
+	}
+	inherit(r,Cp);
+	if (Msg[r->pid].state == MSG_RECEIVING){
+		msg_deliver(Cp,r);
+		make_ready(r);
+		if (handoff(r)){
+			return;
+		}
+	}
+	else{
+		Cp->state = BLOCKED;
+		enqueue_prio(&msg_queue[r->pid],Cp);
+	}
+	Dispatch();
+}
+
+static void kernel_msg_receive(void)
+{
+	volatile PD* s = dequeue(&msg_queue[Cp->pid]);
+
+	if (s != NULL){
+		msg_deliver(s,Cp);
+	}
+	else{
+		Msg[Cp->pid].state = MSG_RECEIVING;
+		Cp->state = WAITING;
+		Dispatch();
+	}
+}
+
+/**
+  * Copy the reply of Cp to the sender and let it go. Cp drops the priority it
+  * inherited from it but keeps what it inherits through anything else: the
+  * senders still queued or awaiting replies, and the locks it holds. If that
+  * lets the sender preempt Cp, it is handed the CPU directly.
+  */
+static void kernel_msg_reply(void)
+{
+	volatile PD* s = lookup_task(kernel_request_pid);
+	MSGD* m;
+
+	if (s == NULL){
+		return;
+	}
+	m = &Msg[s->pid];
+	if (m->state != MSG_REPLY_WAIT || m->partner != Cp->pid){
+		error_msg = ERR_3_NO_SUCH_TASK;
+		OS_Abort();
+		return;
+	}
+	if (m->reply_len > Msg[Cp->pid].reply_len){
+		m->reply_len = Msg[Cp->pid].reply_len;
+	}
+	memcpy(m->reply,Msg[Cp->pid].reply,m->reply_len);
+	m->state = MSG_IDLE;
+	make_ready(s);
+	disinherit(Cp);
+	reinherit(Cp);
+	if (check_rqueue()){
+		Cp->state = READY;
+		enqueue_front(&ready_queue[run_level(Cp)],Cp);
+		if (!handoff(s)){
+			Dispatch();
+		}
+	}
+}
+#endif
+
+#if MAXRWLOCK > 0
+/**
+  * The most urgent task holding l for reading; l must have readers.
+  */
+static volatile PD* rw_top_reader(RWD* l)
+{
+	volatile PD* top = NULL;
+	uint8_t i;
+
+	for (i = 0; i < RWLOCK_READERS; i++){
+		if (l->reader[i] != NULL && (top == NULL || l->reader[i]->priority < top->priority)){
+			top = l->reader[i];
+		}
+	}
+	return top;
+}
+
+static void rw_add_reader(RWD* l, volatile PD* p)
+{
+	uint8_t i;
+
+	for (i = 0; l->reader[i] != NULL; i++)
+		;
+	l->reader[i] = p;
+	++l->readers;
+}
+
+/**
+  * Returns 0 if p does not hold l for reading.
+  */
+static int rw_remove_reader(RWD* l, volatile PD* p)
+{
+	uint8_t i;
+
+	for (i = 0; i < RWLOCK_READERS; i++){
+		if (l->reader[i] == p){
+			l->reader[i] = NULL;
+			--l->readers;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+  * Hand a lock that has just been released on to whoever may have it now:
+  * the first waiting writer once the last reader is gone, else, if no
+  * writer waits, as many waiting readers as fit. A new writer inherits the
+  * priority of the most urgent task still waiting. Returns 1 if a task was
+  * made ready.
+  */
+static int rw_grant(RWD* l)
+{
+	volatile PD* p;
+	int granted = 0;
+
+	if (l->writer != NULL){
+		return 0;
+	}
+	if (l->write_queue.head != NULL){
+		if (l->readers != 0){
+			return 0;
+		}
+		p = dequeue(&l->write_queue);
+		l->writer = p;
+		if (l->write_queue.head != NULL){
+			inherit(p,l->write_queue.head);
+		}
+		if (l->read_queue.head != NULL){
+			inherit(p,l->read_queue.head);
+		}
+		make_ready(p);
+		return 1;
+	}
+	while (l->read_queue.head != NULL && l->readers < RWLOCK_READERS){
+		p = dequeue(&l->read_queue);
+		rw_add_reader(l,p);
+		make_ready(p);
+		granted = 1;
+	}
+	return granted;
+}
+
+/**
+  * Cp has just given up l. It keeps only the priority it inherits through
+  * what it still holds; a waiting writer now raises the most urgent reader
+  * left, if any. Then l goes to whoever may have it, and since Cp may have
+  * dropped, the scheduler checks for preemption either way.
+  */
+static void rw_released(RWD* l)
+{
+	disinherit(Cp);
+	reinherit(Cp);
+	if (l->readers != 0 && l->write_queue.head != NULL){
+		inherit(rw_top_reader(l),l->write_queue.head);
+	}
+	rw_grant(l);
+	preemption();
+}
+
+/**
+  * Block Cp in queue of l and raise whoever holds l: the writer, or the most
+  * urgent reader, which is the one a waiting writer most likely waits on.
+  */
+static void rw_block(RWD* l, queue_t* queue)
+{
+	Cp->state = BLOCKED;
+	enqueue_prio(queue,Cp);
+	inherit((l->writer != NULL) ? l->writer : rw_top_reader(l),Cp);
+	Dispatch();
+}
+#endif
+
+/**
+  * The task p is blocked on, as the holder of a mutex or reader-writer lock
+  * or the receiver of its message, or NULL.
+  */
+static volatile PD* holder_of(volatile PD* p)
+{
+#if MAXMUTEX > 0 || MAXRWLOCK > 0 || MSG_PASSING
+	uint8_t i;
+#endif
+
+	if(p->state!=BLOCKED&&p->state!=WAITING){
+		return NULL;
+	}
+#if MAXMUTEX > 0
+	for(i=0;i<MAXMUTEX;i++){
+		if(p->queue==&Mutex[i].mutex_queue){
+			return Mutex[i].owner;
+		}
+	}
+#endif
+#if MAXRWLOCK > 0
+	for(i=0;i<MAXRWLOCK;i++){
+		if(p->queue==&RWLock[i].read_queue||p->queue==&RWLock[i].write_queue){
+			if(RWLock[i].writer!=NULL){
+				return RWLock[i].writer;
+			}
+			return RWLock[i].readers ? rw_top_reader(&RWLock[i]) : NULL;
+		}
+	}
+#endif
+#if MSG_PASSING
+	for(i=0;i<MAXPROCESS;i++){
+		if(p->queue==&msg_queue[i]){
+			return &Process[i];
+		}
+	}
+	if(p->queue==NULL&&Msg[p->pid].state==MSG_REPLY_WAIT){
+		return &Process[Msg[p->pid].partner];
+	}
+#endif
+	return NULL;
+}
+
+/**
+  * Raise p to the most urgent task waiting on something it holds; used when
+  * the priority of p has just been lowered.
+  */
+static void reinherit(volatile PD* p)
+{
+#if MAXMUTEX > 0 || MAXRWLOCK > 0 || MSG_PASSING
+	uint8_t i;
+#else
+	(void)p;	/* nothing p could hold */
+#endif
+
+#if MAXMUTEX > 0
+	for(i=0;i<MAXMUTEX;i++){
+		if(Mutex[i].state==LOCKED&&Mutex[i].owner==p&&Mutex[i].mutex_queue.head!=NULL){
+			inherit(p,Mutex[i].mutex_queue.head);
+		}
+	}
+#endif
+#if MAXRWLOCK > 0
+	for(i=0;i<MAXRWLOCK;i++){
+		if(RWLock[i].writer==p||(RWLock[i].readers&&rw_top_reader(&RWLock[i])==p)){
+			if(RWLock[i].write_queue.head!=NULL){
+				inherit(p,RWLock[i].write_queue.head);
+			}
+			if(RWLock[i].read_queue.head!=NULL){
+				inherit(p,RWLock[i].read_queue.head);
+			}
+		}
+	}
+#endif
+#if MSG_PASSING
+	if(msg_queue[p->pid].head!=NULL){
+		inherit(p,msg_queue[p->pid].head);
+	}
+	for(i=0;i<MAXPROCESS;i++){
+		if(Msg[i].state==MSG_REPLY_WAIT&&Msg[i].partner==p->pid){
+			inherit(p,&Process[i]);
+		}
+	}
+#endif
+}
+
+/**
+  * Task_SetPriority(): the new priority is the base of the task. If the task
+  * has inherited a more urgent one it keeps running at that, and gets the new
+  * base back from disinherit(). Otherwise it moves to the new ready level, or
+  * to its new place in the wait queue it is in, in constant time for a ready
+  * task; a task it waits on inherits the new priority if that is higher.
+  */
+static void set_priority(volatile PD* p, PRIORITY py)
+{
+	volatile PD* holder;
+
+	if(p->past!=NO_PRIORITY&&py>=p->priority){
+		p->past=py;
+		return;
+	}
+	p->past=NO_PRIORITY;
+	if(py<p->priority){
+		p->priority=py;
+		reposition(p);
+		holder=holder_of(p);
+		if(holder!=NULL){
+			inherit(holder,p);
+		}
+	}
+	else if(py>p->priority){
+		p->priority=py;
+		reposition(p);
+		reinherit(p);
+	}
+}
+
+static void kernel_set_priority(void)
+{
+	volatile PD* p = lookup_task(kernel_request_pid);
+	PRIORITY py = kernel_request_priority;
+
+	if(p==NULL){
+		return;
+	}
+	if(py>MINPRIORITY){
+		error_msg=ERR_8_NO_SUCH_PRIORITY;
+		OS_Abort();
+		return;
+	}
+	set_priority(p,py);
+	preemption();
+}
+
+#if TASK_BUDGETS
+/**
+  * p has spent its budget (posted by budget_tick()): demote or suspend it
+  * until its period ends. Returns 1 if the scheduler must choose again.
+  */
+static int budget_throttle(volatile PD* p)
+{
+	BUDGET* b = &Budget[p->pid];
+
+	if(p->state==DEAD||b->budget==0||b->left!=0||b->throttled){
+		return 0;	/* the budget changed since the tick posted this */
+	}
+	if(b->action==BUDGET_SUSPEND&&p==Cp&&sched_lock){
+		/* suspending would dispatch with the scheduler still locked; the
+		   tick posts this again while the budget stays spent */
+		return 0;
+	}
+	b->throttled=1;
+	++b->overruns;
+	++budget_throttled;
+	if(b->action==BUDGET_SUSPEND){
+		if(p->suspend){
+			return 0;	/* already suspended by the user */
+		}
+		b->suspended=1;
+		suspend_task(p);
+		return 0;	/* suspend_task() dispatched already if p was Cp */
+	}
+	b->base=base_priority(p);
+	b->threshold=p->threshold;
+	p->threshold=NO_PRIORITY;	/* else run_level() would keep it up there */
+	set_priority(p,MINPRIORITY);
+	return 1;
+}
+
+/**
+  * The period of throttled p has ended: give it a new budget and undo what
+  * budget_throttle() did, unless the user changed it meanwhile.
+  * Returns 1 if a task was made ready or raised.
+  */
+static int budget_replenish(volatile PD* p)
+{
+	BUDGET* b = &Budget[p->pid];
+	int readied=0;
+
+	if(!b->throttled){
+		return 0;
+	}
+	b->throttled=0;
+	--budget_throttled;
+	b->left=b->budget;
+	b->next=os_ticks+b->period;
+	if(p->state==DEAD){
+		return 0;
+	}
+	if(b->suspended){
+		b->suspended=0;
+		readied=resume_task(p);
+	}
+	else if(b->action==BUDGET_DEMOTE){
+		if(base_priority(p)==MINPRIORITY){
+			set_priority(p,b->base);
+			readied=1;
+		}
+		if(p->threshold==NO_PRIORITY){
+			p->threshold=b->threshold;
+		}
+	}
+	return readied;
+}
+
+static void kernel_set_budget(void)
+{
+	volatile PD* p = lookup_task(kernel_request_pid);
+	BUDGET* b;
+	int readied;
+
+	if(p==NULL){
+		return;
+	}
+	b=&Budget[p->pid];
+	readied=budget_replenish(p);
+	b->budget=kernel_request_budget.budget;
+	b->period=kernel_request_budget.period;
+	b->action=kernel_request_budget.action;
+	b->left=b->budget;
+	b->next=os_ticks+b->period;
+	b->used=0;
+	b->overruns=0;
+	if(readied){
+		preemption();
+	}
+}
+#endif
+
+static void kernel_set_threshold(void)
+{
+	volatile PD* p = lookup_task(kernel_request_pid);
+	PRIORITY t = kernel_request_priority;
+
+	if(p==NULL){
+		return;
+	}
+	if(t>MINPRIORITY&&t!=NO_PRIORITY){
+		error_msg=ERR_8_NO_SUCH_PRIORITY;
+		OS_Abort();
+		return;
+	}
+	p->threshold=t;
+	/* a lower threshold for Cp may let waiting tasks in */
+	preemption();
+}
+
+/**
+  * Apply the operations of a Kernel_Batch() request in order; whatever they
+  * make ready gets one preemption() at the end.
+  */
+static void kernel_batch(void)
+{
+	const KERNEL_OP* op;
+	uint8_t i;
+	int readied=0;
+
+	for(i=0;i<kernel_batch_count;i++){
+		op=&kernel_batch_ops[i];
+		switch(op->op){
+		case BATCH_SIGNAL:
+			readied|=event_signal(op->arg);
+			break;
+		case BATCH_UNLOCK:
+#if MAXMUTEX > 0
+			readied|=mutex_unlock(op->arg);
+#else
+			error_msg=ERR_4_NO_SUCH_MUTEX;
+			OS_Abort();
+#endif
+			break;
+		case BATCH_RESUME:
+			if(lookup_task(op->arg)!=NULL){
+				readied|=resume_task(&Process[op->arg]);
+			}
+			break;
+		case BATCH_NOTIFY:
+			if(lookup_task(op->arg)!=NULL&&notify_update(&Process[op->arg],op->bits,NOTIFY_SET_BITS)){
+				readied|=notify_wake(&Process[op->arg]);
+			}
+			break;
+		}
+	}
+	if(readied){
+		preemption();
+	}
+}
+
 static void Next_Kernel_Request() 
 {
    Dispatch();  /* select a new task to run */
 
    while(1) {
+#ifdef OS_SWITCH_STATS
+      if(Cp!=switch_last){
+         switch_last=Cp;
+         ++switch_count;
+      }
+#endif
        /* activate this newly selected task */
       CurrentSp = Cp->sp;
-		if(Cp->suspend){	
-			OS_Abort();
-		}
       Exit_Kernel();    /* or CSwitch() */
 
        /* if this task makes a system call, it will return to here! */
         /* save the Cp's stack pointer */
       Cp->sp = CurrentSp;
+#ifdef OS_STACK_CANARY
+      stack_check(Cp);
+#endif
 
       switch(Cp->request){
 			
@@ -581,6 +2155,15 @@ static void Next_Kernel_Request()
            kernel_request_create_args.pid= Kernel_Create_Task( kernel_request_create_args.code , 
 																					kernel_request_create_args.py, 
 																					kernel_request_create_args.arg );
+			  create_cycles=CYCLES_PER_TIMER1_COUNT*(unsigned long)timer1_since(kernel_request_create_args.start);
+			  preemption();
+           break;
+
+      case POOL_ACQUIRE:
+           kernel_request_create_args.pid= pool_acquire( kernel_request_create_args.code , 
+																				kernel_request_create_args.py, 
+																				kernel_request_create_args.arg );
+			  create_cycles=CYCLES_PER_TIMER1_COUNT*(unsigned long)timer1_since(kernel_request_create_args.start);
 			  preemption();
            break;
 			  
@@ -597,15 +2180,38 @@ static void Next_Kernel_Request()
 			Dispatch();
 			break;
 			
-			//If a task suspends itself, put back in ready queue and dispatch??
-		case SUSPEND:			
-			Cp->state=READY;
-			Cp->suspend=1;
+		case SET_PRIORITY:
+			kernel_set_priority();
+			break;
+			
+		case SET_THRESHOLD:
+			kernel_set_threshold();
+			break;
+			
+		case SCHED_UNLOCK:
+			sched_pending=0;
+			preemption();
+			break;
+			
+#if TASK_BUDGETS
+		case SET_BUDGET:
+			kernel_set_budget();
+			break;
+#endif
+			
+		case YIELD_TO:
+			Cp->state = READY;
 			enqueue(&ready_queue[Cp->priority],Cp);
-			Dispatch();
+			if(lookup_task(kernel_request_pid)==NULL||!handoff(&Process[kernel_request_pid])){
+				Dispatch();
+			}
+			break;
+			
+		case SUSPEND:			
+			kernel_suspend();
 			break;
 		case RESUME:
-			preemption();
+			kernel_resume();
 			break;
 		
 	   case NONE:
@@ -614,99 +2220,186 @@ static void Next_Kernel_Request()
       case TERMINATE:
           /* deallocate all resources used by this task */
 			 if(Cp!=idle_task){
+#if TASK_BUDGETS
+				 budget_replenish(Cp);
+				 Budget[Cp->pid].budget=0;
+#endif
 				 Cp->state = DEAD;
 				 enqueue(&dead_pool_queue,Cp);
 				 --Tasks;
 				 Dispatch();
 			 }
           break;
+	   case POOL_PARK:
+		  Cp->state = WAITING;
+		  enqueue(&pool_queue,Cp);
+		  Dispatch();
+		  break;
 	   case SLEEP:
-		  // now enqueue based on sleep time
-		  // enqueue to sleep queue in sleep call
-		  enqueue_sleep(Cp);		  
+		  // Cp->tick holds the requested ticks; a 0 sleep still waits for the next tick
+		  wheel_insert(Cp,os_ticks+(Cp->tick?Cp->tick:1));
+		  Dispatch();
+		  break;
+	   case NOTIFY:
+		  if(notify_wake(&Process[kernel_request_pid])){
+			  preemption();
+		  }
+		  break;
+	   case BATCH:
+		  kernel_batch();
+		  break;
+	   case NOTIFY_WAIT:
+		  //Cp->notify_mask is set; Cp->tick holds the timeout
+		  Cp->state=WAITING;
+		  if(Cp->tick!=NOTIFY_FOREVER){
+			  wheel_insert(Cp,os_ticks+Cp->tick);
+		  }
 		  Dispatch();
 		  break;
 	   case WAKE:
-		  p = dequeue(&sleep_queue);
-		  p->state=READY;
-		  enqueue(&ready_queue[p->priority], p);
-		  preemption();
+		  //tick work; the deferred queue is drained below
+		  if(kernel_wake()
+#if MAXBASIC > 0
+			  |pt_wake()
+#endif
+			  ){
+			  preemption();
+		  }
 		  break;
 		  
+#if MAXMUTEX > 0
 		case LOCK:
+			Cp->deadlock=0;
 			if(Mutex[mutex_unlock_arg].state==FREE){
 				Mutex[mutex_unlock_arg].state=LOCKED;
 				Mutex[mutex_unlock_arg].owner=Cp;
 				Mutex[mutex_unlock_arg].count=1;
+#ifdef OS_MUTEX_STATS
+				stat_acquired(mutex_unlock_arg,Cp,0);
+#endif
 			}
 			else if(Mutex[mutex_unlock_arg].state==LOCKED&&(Mutex[mutex_unlock_arg].owner==Cp)){
 				++Mutex[mutex_unlock_arg].count;
 			}
+#if DEADLOCK_CHECK
+			else if(deadlock_cycle(mutex_unlock_arg)){
+				error_msg=FAIL_2_DEADLOCK;
+#if DEADLOCK_CHECK == 2
+				OS_Abort();
+#endif
+				Cp->deadlock=1;
+			}
+#endif
 			else{
 				Cp->state=BLOCKED;
-				enqueue(&Mutex[mutex_unlock_arg].mutex_queue,Cp);
+#ifdef OS_MUTEX_STATS
+				Cp->tick=timer1_now();
+#endif
+				enqueue_prio(&Mutex[mutex_unlock_arg].mutex_queue,Cp);
 				
 				//Priority Inheritance
-				if(Mutex[mutex_unlock_arg].owner->priority>Cp->priority){
-					if(Mutex[mutex_unlock_arg].owner->past==-1){
-						Mutex[mutex_unlock_arg].owner->past= Mutex[mutex_unlock_arg].owner->priority;
-					}
-					Mutex[mutex_unlock_arg].owner->priority=Cp->priority;
-					volatile PD * p = find_in_ready(Mutex[mutex_unlock_arg].owner->pid);
-					if(p!=NULL){
-						enqueue(&ready_queue[Mutex[mutex_unlock_arg].owner->priority],Mutex[mutex_unlock_arg].owner);
-					}
-				}
+				inherit(Mutex[mutex_unlock_arg].owner,Cp);
 				Dispatch();
 			}
 			break;
 			
 		case UNLOCK:
-			if(Mutex[mutex_unlock_arg].owner!=Cp){
+			if(mutex_unlock(mutex_unlock_arg)){
+				preemption();
+			}
+			break;	
+
+#if MSG_PASSING
+		case MSG_SEND:
+			kernel_msg_send();
+			break;
+		case MSG_RECEIVE:
+			kernel_msg_receive();
+			break;
+		case MSG_REPLY:
+			kernel_msg_reply();
+			break;
+#endif
+#if MAXCOND > 0
+		case COND_WAIT:
+			if(Mutex[mutex_unlock_arg].owner!=Cp||Mutex[mutex_unlock_arg].count!=1){
 				error_msg= FAIL_2_DEADLOCK;
 				OS_Abort();
 			}
-			else if(Mutex[mutex_unlock_arg].state==LOCKED&&Mutex[mutex_unlock_arg].count>1){
-				--Mutex[mutex_unlock_arg].count;
+			//release and wait in one request, so no signal can come in between
+			Cond[cond_arg].mutex=mutex_unlock_arg;
+			mutex_release(mutex_unlock_arg);
+			Cp->state=WAITING;
+			enqueue_prio(&Cond[cond_arg].queue,Cp);
+			Dispatch();
+			break;
+
+		case COND_SIGNAL:
+			if(cond_wake(cond_arg)){
+				preemption();
 			}
-			else if(Mutex[mutex_unlock_arg].mutex_queue.head!=NULL){
-				volatile PD* p=dequeue(&Mutex[mutex_unlock_arg].mutex_queue);
-				
-				
-				//Priority Inheritance
-				if(Mutex[mutex_unlock_arg].owner->priority<p->priority){
-					if(p->past==-1){
-						p->past=p->priority;
-					}
-					p->priority=Mutex[mutex_unlock_arg].owner->priority;
-				}
-				if( Mutex[mutex_unlock_arg].owner->past >-1){
-					Mutex[mutex_unlock_arg].owner->priority=Mutex[mutex_unlock_arg].owner->past;
-					Mutex[mutex_unlock_arg].owner->past=-1;
-				}
-				Mutex[mutex_unlock_arg].owner=p;
-				p->state=READY;
-				enqueue(&ready_queue[p->priority],p);
+			break;
+
+		case COND_BROADCAST:
+			if(cond_wake(cond_arg)){
+				while(cond_wake(cond_arg))
+					;
 				preemption();
 			}
+			break;
+#endif
+		
+#endif
+#if MAXRWLOCK > 0
+		case READ_LOCK:
+			//writer preference: a waiting writer keeps new readers out
+			if(RWLock[rwlock_arg].writer==NULL&&RWLock[rwlock_arg].write_queue.head==NULL
+			   &&RWLock[rwlock_arg].readers<RWLOCK_READERS){
+				rw_add_reader(&RWLock[rwlock_arg],Cp);
+			}
 			else{
-				Mutex[mutex_unlock_arg].state=FREE;
-				Mutex[mutex_unlock_arg].count=0;
+				rw_block(&RWLock[rwlock_arg],&RWLock[rwlock_arg].read_queue);
 			}
-			break;	
-		
+			break;
+
+		case READ_UNLOCK:
+			if(!rw_remove_reader(&RWLock[rwlock_arg],Cp)){
+				error_msg= FAIL_2_DEADLOCK;
+				OS_Abort();
+			}
+			rw_released(&RWLock[rwlock_arg]);
+			break;
+
+		case WRITE_LOCK:
+			if(RWLock[rwlock_arg].writer==NULL&&RWLock[rwlock_arg].readers==0){
+				RWLock[rwlock_arg].writer=Cp;
+			}
+			else{
+				rw_block(&RWLock[rwlock_arg],&RWLock[rwlock_arg].write_queue);
+			}
+			break;
+
+		case WRITE_UNLOCK:
+			if(RWLock[rwlock_arg].writer!=Cp){
+				error_msg= FAIL_2_DEADLOCK;
+				OS_Abort();
+			}
+			RWLock[rwlock_arg].writer=NULL;
+			rw_released(&RWLock[rwlock_arg]);
+			break;
+#endif
 		case EVENT_INIT:
-        kernel_request_event_ptr = NULL;
         if(num_events_created < MAXEVENT)
         {
-            kernel_request_event_ptr = (EVENT *)(uint16_t)(&num_events_created);
+            kernel_request_event = num_events_created;
             ++num_events_created;
         }
         else
         {
 			  
-            kernel_request_event_ptr = (EVENT *)(uint16_t)-1;
+            kernel_request_event = (EVENT)-1;
         }
+        kernel_request_event_ptr = &kernel_request_event;
         break;	
 	
 		case EVENT_WAIT:
@@ -720,10 +2413,26 @@ static void Next_Kernel_Request()
 		case EVENT_SIGNAL:
 			kernel_event_signal();
 			break;
+
+#if MAXBASIC > 0
+		case ACTIVATE:
+			if(basic_activate(kernel_request_basic)){
+				preemption();
+			}
+			break;
+
+		case BASIC_DONE:
+			kernel_basic_done();
+			break;
+#endif
 			
       default:
          break;
        }
+
+		if(deferred_head!=deferred_tail){
+			kernel_run_deferred();
+		}
     } 
 }
 
@@ -752,6 +2461,31 @@ void set_timer()
   *================
   */
 
+#ifdef OS_STATIC_TASKS
+/**
+  * Make the static tasks ready. Their PDs are initialized data already; what
+  * is left is what a linker cannot do: lay the return addresses of the task
+  * and of Task_Terminate() into each stack and link the PDs into the ready
+  * queues. No kernel request is involved.
+  */
+static void static_tasks_init(void)
+{
+	uint8_t x;
+	volatile PD* p;
+
+	for (x = 0; x < OS_STATIC_TASK_COUNT; x++) {
+		p = &Process[x];
+#ifdef OS_STACK_CANARY
+		static_stack[x].base[0] = STACK_CANARY;
+		static_stack[x].base[1] = STACK_CANARY;
+#endif
+		init_frame(&static_stack[x].base[static_stack[x].size-1],p->code,Task_Terminate);
+		enqueue(&ready_queue[p->priority],p);
+		++Tasks;
+	}
+}
+#endif
+
 /**
   * This function initializes the RTOS and must be called before any other
   * system calls.
@@ -776,138 +2510,509 @@ void OS_Init()
    Tasks = 0;
    KernelActive = 0;
    NextP = 0;
-	//Reminder: Clear the memory for the task on creation.
-   for (x = 0; x < MAXPROCESS-1; x++) {
-      memset(&(Process[x]), 0, sizeof(PD));
-      Process[x].state = DEAD;
+	/*
+	 * Process[], Mutex[] and event_queue[] are static storage, already zero
+	 * (DEAD, OPEN, empty) or holding the static configuration from
+	 * os_config.h; only the dead pool links are built here.
+	 */
+	for (x = OS_STATIC_TASK_COUNT; x < MAXPROCESS-1; x++) {
 		Process[x].pid=x;
 		Process[x].next=&Process[x+1];
-   }
-	for (x=0;x<MAXMUTEX;x++){
-		//un owned mutex=-1, owned mutex=pid of owner, mutex identified by index in mutex array.
-		
-		Mutex[x].state=OPEN;
-		Mutex[x].owner=NULL;
-		Mutex[x].mutex_queue.head=NULL;
-		Mutex[x].mutex_queue.tail=NULL;
-		Mutex[x].count=0;
-			
-	}
-	for (x=0;x<MAXEVENT;x++){
-		
-		event_queue[x].head=NULL;
-		event_queue[x].tail=NULL;
-		
 	}
-	Process[MAXPROCESS-1].state=DEAD;
-	Process[MAXPROCESS-1].next=NULL;
-	dead_pool_queue.head = &Process[0];
+	Process[MAXPROCESS-1].pid=MAXPROCESS-1;
+	Process[MAXPROCESS].pid=MAXPROCESS;
+	dead_pool_queue.head = &Process[OS_STATIC_TASK_COUNT];
 	dead_pool_queue.tail = &Process[MAXPROCESS - 1];
+#ifdef OS_STATIC_TASKS
+	static_tasks_init();
+#endif
 	
 	Kernel_Create_Task(idle,11,0);
+#if TASKPOOL_PREWARM > 0
+	for (x=0;x<TASKPOOL_PREWARM;x++){
+		volatile PD* p=&Process[Kernel_Create_Task(pool_worker,MINPRIORITY,0)];
+		dequeue_task(p);
+		p->state=WAITING;
+		enqueue(&pool_queue,p);
+	}
+#endif
+#if MAXBASIC > 0
+	num_basic=0;
+	basic_depth=0;
+	for (x=0;x<=MINPRIORITY;x++){
+		basic_pending_head[x]=NO_BASIC;
+	}
+	for (x=0;x<MAXEVENT;x++){
+		pt_event_waiters[x]=NO_BASIC;
+	}
+	for (x=0;x<WHEEL_LEVELS*WHEEL_SLOTS;x++){
+		pt_wheel[x]=NO_BASIC;
+	}
+	pt_expired=NO_BASIC;
+	basic_runner->pid=MAXPROCESS+1;
+	basic_runner->code=basic_exit;
+	basic_runner->past=NO_PRIORITY;
+	basic_runner->threshold=NO_PRIORITY;
+	basic_runner->tslot=NO_SLOT;
+	basic_runner->state=WAITING;
+#endif
+#if MAXTIMER > 0
+	/* timer_service() only takes an event and a task slot once a timer is created */
+	timer_list=NULL;
+#endif
 }
 
 static void _delay_25ms(void)
 {
 	uint16_t i;
 
-	/* 4 * 50000 CPU cycles = 25 ms */
-	asm volatile ("1: sbiw %0,1" "\n\tbrne 1b" : "=w" (i) : "0" (50000));
+	/* 4 * 50000 CPU cycles = 25 ms */
+	asm volatile ("1: sbiw %0,1" "\n\tbrne 1b" : "=w" (i) : "0" (50000));
+}
+
+
+void OS_Abort(void)
+{
+	switch (error_msg){
+		case ERR_1_TOO_MANY_TASK:
+				PORTC|=(1<<PC0);
+				break;
+		case ERR_2_TOO_MANY_MUTEX:
+				PORTC|=(1<<PC1);
+				break;
+		case ERR_3_NO_SUCH_TASK:
+				PORTC|=(1<<PC2);
+				break;
+		case ERR_4_NO_SUCH_MUTEX:
+				PORTC|=(1<<PC3);
+				break;
+		case ERR_5_TOO_MANY_TIMER:
+				PORTC|=(1<<PC0)|(1<<PC1);
+				break;
+		case ERR_6_TOO_MANY_RWLOCK:
+				PORTC|=(1<<PC0)|(1<<PC2);
+				break;
+		case ERR_7_TOO_MANY_COND:
+				PORTC|=(1<<PC0)|(1<<PC3);
+				break;
+		case ERR_8_NO_SUCH_PRIORITY:
+				PORTC|=(1<<PC1)|(1<<PC2);
+				break;
+		case ERR_9_TOO_MANY_SERVER:
+				PORTC|=(1<<PC1)|(1<<PC3);
+				break;
+		case FAIL_1_STACK_OVERFLOW:
+		for(;;){
+				PORTC|=(1<<PC1)|(1<<PC2)|(1<<PC3)|(1<<PC0);
+				_delay_25ms();
+				_delay_25ms();
+				_delay_25ms();
+				PORTC&=~(1<<PC1)&~(1<<PC2)&~(1<<PC3)&~(1<<PC0);
+				_delay_25ms();
+				_delay_25ms();
+				_delay_25ms();
+		}
+		case FAIL_2_DEADLOCK:
+		for(;;){
+				PORTC|=(1<<PC0)|(1<<PC3);
+				_delay_25ms();
+				_delay_25ms();
+				_delay_25ms();
+				PORTC&=~(1<<PC0)&~(1<<PC3);
+				_delay_25ms();
+				_delay_25ms();
+				_delay_25ms();
+				
+		}
+	}
+}
+
+/**
+  * This function starts the RTOS after creating a few tasks.
+  */
+void OS_Start() 
+{   
+   if ( (! KernelActive) && (Tasks > 0)) {
+       Disable_Interrupt();
+      /* we may have to initialize the interrupt vector for Enter_Kernel() here. */
+
+      /* here we go...  */
+      KernelActive = 1;
+      Cp = idle_task;   /* so the first Dispatch() has a valid Cp to replace */
+#if MAXBASIC > 0
+      basic_schedule();   /* protothreads created before OS_Start() */
+#endif
+      Next_Kernel_Request();
+      /* NEVER RETURNS!!! */
+   }
+}
+
+#if MAXMUTEX > 0
+MUTEX Mutex_Init(void){
+	int x;
+	for(x=0;x<MAXMUTEX;x++){
+		if (Mutex[x].state==OPEN){
+			Mutex[x].state=FREE;
+			return x;
+		}
+	}
+	/*Too Many Mutex*/
+	error_msg=ERR_2_TOO_MANY_MUTEX;
+	OS_Abort();
+	return -1;
+}
+
+
+int Mutex_Lock(MUTEX m){
+		uint8_t sreg;
+		sreg=SREG;
+		Disable_Interrupt();
+		Cp->request=LOCK;
+		mutex_unlock_arg=m;
+		Enter_Kernel();
+		SREG=sreg;
+		return !Cp->deadlock;
+}
+
+#if DEADLOCK_CHECK
+const struct deadlock_report* Mutex_GetDeadlock(void){
+	return &deadlock_report;
+}
+#endif
+
+#ifdef OS_MUTEX_STATS
+void Mutex_GetStats(MUTEX m, struct mutex_stat* stat){
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	*stat=MutexStats[m];
+	SREG=sreg;
+}
+
+static void uart_putc(char c)
+{
+	while (!(UCSR0A & (1<<UDRE0)))
+		;
+	UDR0 = c;
+}
+
+static void uart_puts(const char* s)
+{
+	while (*s){
+		uart_putc(*s++);
+	}
+}
+
+static void uart_putul(unsigned long v)
+{
+	char digits[10];
+	uint8_t n = 0;
+
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n){
+		uart_putc(digits[--n]);
+	}
+}
+
+/**
+  * Print the counters of every initialized mutex to USART0, 8N1 at
+  * STATS_BAUD, as
+  *   mutex 0 acq 12 contended 3 wait 210/95 hold 4800/610 holder 2
+  * with wait and hold as total/max in TIMER1 counts. Busy-waits on the UART,
+  * so call it from a low-priority task.
+  */
+void Mutex_DumpStats(void){
+	struct mutex_stat st;
+	uint8_t m;
+
+	UBRR0 = F_CPU/16/STATS_BAUD - 1;
+	UCSR0B = (1<<TXEN0);
+	UCSR0C = (1<<UCSZ01)|(1<<UCSZ00);
+	for (m = 0; m < MAXMUTEX; m++){
+		if (Mutex[m].state == OPEN){
+			continue;
+		}
+		Mutex_GetStats(m,&st);
+		uart_puts("mutex ");
+		uart_putul(m);
+		uart_puts(" acq ");
+		uart_putul(st.acquisitions);
+		uart_puts(" contended ");
+		uart_putul(st.contended);
+		uart_puts(" wait ");
+		uart_putul(st.wait_total);
+		uart_putc('/');
+		uart_putul(st.wait_max);
+		uart_puts(" hold ");
+		uart_putul(st.hold_total);
+		uart_putc('/');
+		uart_putul(st.hold_max);
+		uart_puts(" holder ");
+		uart_putul(st.max_holder);
+		uart_puts("\r\n");
+	}
+}
+#endif
+
+void Mutex_Unlock(MUTEX m){
+		uint8_t sreg;
+		sreg=SREG;
+		Disable_Interrupt();
+		Cp->request=UNLOCK;
+		mutex_unlock_arg=m;
+		Enter_Kernel();
+		SREG=sreg;
+}
+#endif
+
+/** Keep the compiler from moving memory accesses across this point. */
+#define Memory_Barrier()		asm volatile ("":::"memory")
+
+/**
+  * Publish size bytes from data. Only the buffer readers are not using is
+  * written; the seq increment at the end switches them over to it.
+  */
+void Snapshot_Publish(SNAPSHOT* s, const void* data){
+	unsigned char next = (unsigned char)((s->seq >> 1) + 1) & 1;
+
+	++s->seq;
+	Memory_Barrier();
+	memcpy(&s->buf[next * s->size],data,s->size);
+	Memory_Barrier();
+	++s->seq;
+}
+
+/**
+  * Copy the last complete publish to data.
+  */
+void Snapshot_Read(SNAPSHOT* s, void* data){
+	unsigned char seq;
+
+	do {
+		seq = s->seq & ~1;
+		Memory_Barrier();
+		memcpy(data,&s->buf[((seq >> 1) & 1) * s->size],s->size);
+		Memory_Barrier();
+		/* the buffer read is only written again by the publish after next */
+	} while ((unsigned char)(s->seq - seq) >= 3);
+}
+
+/**
+  * Update the notification bits of p. This is a kernel request only if p is
+  * waiting for one of the bits set by it.
+  */
+void Task_Notify(PID p, unsigned char bits, NOTIFY_ACTION action){
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	if(lookup_task(p)!=NULL&&notify_update(&Process[p],bits,action)){
+		Cp->request=NOTIFY;
+		kernel_request_pid=p;
+		Enter_Kernel();
+	}
+	SREG=sreg;
+}
+
+void Kernel_Batch(const KERNEL_OP* ops, unsigned char n){
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp->request=BATCH;
+	kernel_batch_ops=ops;
+	kernel_batch_count=n;
+	Enter_Kernel();
+	SREG=sreg;
+}
+
+/**
+  * Block Cp until one of mask is set or timeout runs out, unless one already
+  * is or timeout is 0. Call with interrupts off; they are off on return.
+  */
+static void notify_block(unsigned char mask, TICK timeout){
+	if(!(Cp->notify&mask)&&timeout!=0){
+		Cp->notify_mask=mask;
+		Cp->tick=timeout;
+		Cp->request=NOTIFY_WAIT;
+		Enter_Kernel();
+		Disable_Interrupt();	//Exit_Kernel returns with interrupts on
+		Cp->notify_mask=0;
+	}
+}
+
+unsigned char Task_NotifyWait(unsigned char mask, TICK timeout){
+	uint8_t sreg;
+	unsigned char bits;
+	sreg=SREG;
+	Disable_Interrupt();
+	notify_block(mask,timeout);
+	bits=Cp->notify&mask;
+	Cp->notify&=~bits;
+	SREG=sreg;
+	return bits;
+}
+
+unsigned char Task_NotifyTake(TICK timeout){
+	uint8_t sreg;
+	unsigned char count;
+	sreg=SREG;
+	Disable_Interrupt();
+	notify_block(0xFF,timeout);
+	count=Cp->notify;
+	if(count!=0){
+		--Cp->notify;
+	}
+	SREG=sreg;
+	return count;
+}
+
+#if MSG_PASSING
+int Msg_Send(PID p, const void* req, unsigned char req_len, void* reply, unsigned char reply_len){
+	uint8_t sreg;
+	MSGD* m=&Msg[Cp->pid];
+	sreg=SREG;
+	Disable_Interrupt();
+	m->buf=(unsigned char*)req;
+	m->len=req_len;
+	m->reply=reply;
+	m->reply_len=reply_len;
+	Cp->request=MSG_SEND;
+	kernel_request_pid=p;
+	Enter_Kernel();
+	SREG=sreg;
+	return m->partner<MAXPROCESS?m->reply_len:-1;
+}
+
+int Msg_Receive(PID* sender, void* buf, unsigned char len){
+	uint8_t sreg;
+	MSGD* m=&Msg[Cp->pid];
+	sreg=SREG;
+	Disable_Interrupt();
+	m->buf=buf;
+	m->len=len;
+	Cp->request=MSG_RECEIVE;
+	Enter_Kernel();
+	SREG=sreg;
+	*sender=m->partner;
+	return m->len;
+}
+
+void Msg_Reply(PID sender, const void* reply, unsigned char len){
+	uint8_t sreg;
+	MSGD* m=&Msg[Cp->pid];
+	sreg=SREG;
+	Disable_Interrupt();
+	m->reply=(unsigned char*)reply;
+	m->reply_len=len;
+	Cp->request=MSG_REPLY;
+	kernel_request_pid=sender;
+	Enter_Kernel();
+	SREG=sreg;
 }
+#endif
 
+#if MAXCOND > 0
+COND Cond_Init(void){
+	uint8_t sreg;
+	int x;
 
-void OS_Abort(void)
-{
-	switch (error_msg){
-		case ERR_1_TOO_MANY_TASK:
-				PORTC|=(1<<PC0);
-				break;
-		case ERR_2_TOO_MANY_MUTEX:
-				PORTC|=(1<<PC1);
-				break;
-		case ERR_3_NO_SUCH_TASK:
-				PORTC|=(1<<PC2);
-				break;
-		case ERR_4_NO_SUCH_MUTEX:
-				PORTC|=(1<<PC3);
-				break;
-		case FAIL_1_STACK_OVERFLOW:
-		for(;;){
-				PORTC|=(1<<PC1)|(1<<PC2)|(1<<PC3)|(1<<PC0);
-				_delay_25ms();
-				_delay_25ms();
-				_delay_25ms();
-				PORTC&=~(1<<PC1)&~(1<<PC2)&~(1<<PC3)&~(1<<PC0);
-				_delay_25ms();
-				_delay_25ms();
-				_delay_25ms();
-		}
-		case FAIL_2_DEADLOCK:
-		for(;;){
-				PORTC|=(1<<PC0)|(1<<PC3);
-				_delay_25ms();
-				_delay_25ms();
-				_delay_25ms();
-				PORTC&=~(1<<PC0)&~(1<<PC3);
-				_delay_25ms();
-				_delay_25ms();
-				_delay_25ms();
-				
+	sreg=SREG;
+	Disable_Interrupt();
+	for(x=0;x<MAXCOND;x++){
+		if(!Cond[x].allocated){
+			Cond[x].allocated=1;
+			SREG=sreg;
+			return x;
 		}
 	}
+	SREG=sreg;
+	error_msg=ERR_7_TOO_MANY_COND;
+	OS_Abort();
+	return -1;
 }
 
-/**
-  * This function starts the RTOS after creating a few tasks.
-  */
-void OS_Start() 
-{   
-   if ( (! KernelActive) && (Tasks > 0)) {
-       Disable_Interrupt();
-      /* we may have to initialize the interrupt vector for Enter_Kernel() here. */
+void Cond_Wait(COND c, MUTEX m){
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp->request=COND_WAIT;
+	cond_arg=c;
+	mutex_unlock_arg=m;
+	Enter_Kernel();
+	SREG=sreg;
+}
 
-      /* here we go...  */
-      KernelActive = 1;
-      Next_Kernel_Request();
-      /* NEVER RETURNS!!! */
-   }
+void Cond_Signal(COND c){
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp->request=COND_SIGNAL;
+	cond_arg=c;
+	Enter_Kernel();
+	SREG=sreg;
 }
 
-MUTEX Mutex_Init(void){
+void Cond_Broadcast(COND c){
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp->request=COND_BROADCAST;
+	cond_arg=c;
+	Enter_Kernel();
+	SREG=sreg;
+}
+#endif
+
+#if MAXRWLOCK > 0
+RWLOCK RWLock_Init(void){
+	uint8_t sreg;
 	int x;
-	for(x=0;x<MAXMUTEX;x++){
-		if (Mutex[x].state==OPEN){
-			Mutex[x].state=FREE;
+
+	sreg=SREG;
+	Disable_Interrupt();
+	for(x=0;x<MAXRWLOCK;x++){
+		if(!RWLock[x].allocated){
+			RWLock[x].allocated=1;
+			SREG=sreg;
 			return x;
 		}
 	}
-	/*Too Many Mutex*/
-	error_msg=ERR_2_TOO_MANY_MUTEX;
+	SREG=sreg;
+	error_msg=ERR_6_TOO_MANY_RWLOCK;
 	OS_Abort();
 	return -1;
 }
 
+/** Issue one of the reader-writer lock requests for l. */
+static void rwlock_request(RWLOCK l, KERNEL_REQUEST_TYPE request){
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp->request=request;
+	rwlock_arg=l;
+	Enter_Kernel();
+	SREG=sreg;
+}
 
-void Mutex_Lock(MUTEX m){
-		uint8_t sreg;
-		sreg=SREG;
-		Disable_Interrupt();
-		Cp->request=LOCK;
-		mutex_unlock_arg=m;
-		Enter_Kernel();
-		SREG=sreg;
+void RWLock_ReadLock(RWLOCK l){
+	rwlock_request(l,READ_LOCK);
 }
 
-void Mutex_Unlock(MUTEX m){
-		uint8_t sreg;
-		sreg=SREG;
-		Disable_Interrupt();
-		Cp->request=UNLOCK;
-		mutex_unlock_arg=m;
-		Enter_Kernel();
-		SREG=sreg;
+void RWLock_ReadUnlock(RWLOCK l){
+	rwlock_request(l,READ_UNLOCK);
+}
+
+void RWLock_WriteLock(RWLOCK l){
+	rwlock_request(l,WRITE_LOCK);
 }
 
+void RWLock_WriteUnlock(RWLOCK l){
+	rwlock_request(l,WRITE_UNLOCK);
+}
+#endif
+
 /**
   * For this example, we only support cooperatively multitasking, i.e.,
   * each task gives up its share of the processor voluntarily by calling
@@ -919,6 +3024,7 @@ PID Task_Create( voidfuncptr f, PRIORITY py, int arg)
 		sreg=SREG;
    if (KernelActive ) {
      Disable_Interrupt();
+	  kernel_request_create_args.start = TCNT1;
 	  kernel_request_create_args.code = (voidfuncptr)f;
 	  kernel_request_create_args.arg = arg;
 	  kernel_request_create_args.py = py;
@@ -961,14 +3067,282 @@ void Task_Sleep(TICK t)
 	
 }
 
-void Task_Yield()
+TICK OS_GetTicks(void)
+{
+	TICK now;
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	now=os_ticks;
+	SREG=sreg;
+	return now;
+}
+
+#ifdef OS_SWITCH_STATS
+unsigned long OS_GetSwitches(void)
+{
+	unsigned long n;
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	n=switch_count;
+	SREG=sreg;
+	return n;
+}
+#endif
+
+void Task_Yield()
+{
+		uint8_t sreg;
+		sreg=SREG;
+		Disable_Interrupt();
+		Cp ->request = YIELD;
+		Enter_Kernel();
+		SREG=sreg;
+}
+
+void Task_SetPriority(PID p, PRIORITY py)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp->request = SET_PRIORITY;
+	kernel_request_pid = p;
+	kernel_request_priority = py;
+	Enter_Kernel();
+	SREG=sreg;
+}
+
+/**
+  * Only the calling task writes sched_lock, so it needs no critical section:
+  * an ISR that enters the kernel half way through sees either value, and
+  * the kernel never changes it.
+  */
+void Sched_Lock(void)
+{
+	++sched_lock;
+}
+
+/**
+  * Enter the kernel only if a preemption was held back.
+  */
+void Sched_Unlock(void)
+{
+	uint8_t sreg;
+
+	if(--sched_lock==0&&sched_pending){
+		sreg=SREG;
+		Disable_Interrupt();
+		Cp->request = SCHED_UNLOCK;
+		Enter_Kernel();
+		SREG=sreg;
+	}
+}
+
+void Task_SetThreshold(PID p, PRIORITY t)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp->request = SET_THRESHOLD;
+	kernel_request_pid = p;
+	kernel_request_priority = t;
+	Enter_Kernel();
+	SREG=sreg;
+}
+
+#if TASK_BUDGETS
+void Task_SetBudget(PID p, unsigned int budget, unsigned int period, BUDGET_ACTION action)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	kernel_request_pid = p;
+	kernel_request_budget.budget = budget;
+	kernel_request_budget.period = period;
+	kernel_request_budget.action = action;
+	if (KernelActive){
+		Cp->request = SET_BUDGET;
+		Enter_Kernel();
+	}
+	else{
+		/* call the RTOS function directly; nothing is throttled yet */
+		kernel_set_budget();
+	}
+	SREG=sreg;
+}
+
+void Task_GetBudgetStats(PID p, struct budget_stat* s)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	s->used=Budget[p].used;
+	s->overruns=Budget[p].overruns;
+	s->left=Budget[p].left;
+	s->throttled=Budget[p].throttled;
+	SREG=sreg;
+}
+#endif
+
+#if MAXSERVER > 0
+/**
+  * Body of every server task: run the posted jobs in order and wait for a
+  * notification when there are none. Its budget suspends it, mid-job if need
+  * be, once the capacity of the period is spent.
+  */
+static void server_body(void)
+{
+	SD* s = &Server[Task_GetArg()];
+	SERVER_JOB job;
+	uint8_t sreg;
+
+	for(;;){
+		sreg=SREG;
+		Disable_Interrupt();
+		if(s->count==0){
+			SREG=sreg;
+			/* a job posted since the check has set the bit already */
+			Task_NotifyWait(1,NOTIFY_FOREVER);
+			continue;
+		}
+		job=s->job[s->head];
+		s->head=(s->head+1)%SERVER_QUEUE;
+		--s->count;
+		SREG=sreg;
+		job.f(job.arg);
+	}
+}
+
+SERVER Server_Create(PRIORITY py, unsigned int capacity, unsigned int period)
+{
+	uint8_t sreg;
+	int x;
+
+	sreg=SREG;
+	Disable_Interrupt();
+	for(x=0;x<MAXSERVER;x++){
+		if(!Server[x].allocated){
+			Server[x].allocated=1;
+			SREG=sreg;
+			Server[x].pid=Task_Create(server_body,py,x);
+			Task_SetBudget(Server[x].pid,capacity,period,BUDGET_SUSPEND);
+			return x;
+		}
+	}
+	SREG=sreg;
+	error_msg=ERR_9_TOO_MANY_SERVER;
+	OS_Abort();
+	return -1;
+}
+
+/** Append f(arg) to the jobs of s; 0 if they are full. */
+static int server_push(SERVER s, void (*f)(int), int arg)
+{
+	SD* sd = &Server[s];
+	uint8_t sreg;
+	int queued = 0;
+
+	sreg=SREG;
+	Disable_Interrupt();
+	if(sd->count<SERVER_QUEUE){
+		sd->job[(sd->head+sd->count)%SERVER_QUEUE].f=f;
+		sd->job[(sd->head+sd->count)%SERVER_QUEUE].arg=arg;
+		++sd->count;
+		queued=1;
+	}
+	SREG=sreg;
+	return queued;
+}
+
+int Server_Post(SERVER s, void (*f)(int), int arg)
+{
+	if(!server_push(s,f,arg)){
+		return 0;
+	}
+	Task_Notify(Server[s].pid,1,NOTIFY_SET_BITS);
+	return 1;
+}
+
+int Defer_Server_Post(SERVER s, void (*f)(int), int arg)
+{
+	if(!server_push(s,f,arg)){
+		return 0;
+	}
+	if(!Defer_Task_Notify(Server[s].pid,1,NOTIFY_SET_BITS)){
+		/* the job is queued and the bit set; server_tick() posts the wake-up */
+		Server[s].wake_lost=1;
+		server_wake_lost=1;
+	}
+	return 1;
+}
+
+PID Server_GetPid(SERVER s)
+{
+	return Server[s].pid;
+}
+#endif
+
+PRIORITY Task_GetPriority(PID p)
+{
+	uint8_t sreg;
+	PRIORITY py = NO_PRIORITY;
+	sreg=SREG;
+	Disable_Interrupt();
+	if(p<MAXPROCESS&&Process[p].state!=DEAD){
+		py=base_priority(&Process[p]);
+	}
+	SREG=sreg;
+	return py;
+}
+
+/**
+  * Give the CPU to p rather than to the next task at the caller's priority.
+  * p must be ready and no task more urgent than p may be; otherwise this is
+  * Task_Yield(). Meant for pairs of equal priority that take turns.
+  */
+void Task_YieldTo(PID p)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp->request = YIELD_TO;
+	kernel_request_pid = p;
+	Enter_Kernel();
+	SREG=sreg;
+}
+
+/**
+  * Like Task_Create(), but the task comes from a pool of workers whose earlier
+  * job has returned, so no new stack frame is set up. It runs at the priority
+  * of the caller. A job that returns parks its worker for reuse; one that
+  * calls Task_Terminate() gives the PD back as usual.
+  */
+PID TaskPool_Acquire(voidfuncptr f, int arg)
 {
-		uint8_t sreg;
-		sreg=SREG;
-		Disable_Interrupt();
-		Cp ->request = YIELD;
-		Enter_Kernel();
-		SREG=sreg;
+	uint8_t sreg;
+
+	if (!KernelActive){
+		return pool_acquire(f,MINPRIORITY,arg);
+	}
+	sreg=SREG;
+	Disable_Interrupt();
+	kernel_request_create_args.start = TCNT1;
+	kernel_request_create_args.code = f;
+	kernel_request_create_args.arg = arg;
+	kernel_request_create_args.py = base_priority(Cp);
+	Cp->request = POOL_ACQUIRE;
+	Enter_Kernel();
+	SREG=sreg;
+	return kernel_request_create_args.pid;
+}
+
+/**
+  * CPU cycles the last Task_Create() or TaskPool_Acquire() made by a task
+  * took, from the call up to the new task being queued.
+  */
+unsigned long Task_CreateCycles(void){
+	return create_cycles;
 }
 
 int  Task_GetArg(void){
@@ -977,34 +3351,20 @@ int  Task_GetArg(void){
 
 
 void Task_Suspend( PID p ){
-	int i;
-	for(i=0;i<11;i++){
-		if (Process[i].pid==p){
-			Process[i].suspend=1;
-			break;
-		}
-	}
-	if (p==Cp->pid){
-		uint8_t sreg;
-		sreg=SREG;
-		Disable_Interrupt();
-		Cp ->request = SUSPEND;
-		Enter_Kernel();
-		SREG=sreg;
-	}
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	Cp ->request = SUSPEND;
+	kernel_request_pid = p;
+	Enter_Kernel();
+	SREG=sreg;
 }  
 void Task_Resume( PID p ){
-	int i;
-	for(i=0;i<11;i++){
-		if (Process[i].pid==p){
-			Process[i].suspend=0;
-			break;
-		}
-	}
 	uint8_t sreg;
 	sreg=SREG;
 	Disable_Interrupt();
 	Cp ->request = RESUME;
+	kernel_request_pid = p;
 	Enter_Kernel();
 	SREG=sreg;
 }
@@ -1052,13 +3412,10 @@ void Event_Wait(EVENT e)
     uint8_t sreg;
 
     sreg = SREG;
-
-	 if (event_queue[e].head==NULL){
-		 Disable_Interrupt();
-		 Cp->request = EVENT_WAIT;
-		 kernel_request_event_ptr = &e;
-		 Enter_Kernel();
-	 }
+    Disable_Interrupt();
+    Cp->request = EVENT_WAIT;
+    kernel_request_event_ptr = &e;
+    Enter_Kernel();
     SREG = sreg;
 }
 
@@ -1076,32 +3433,460 @@ void Event_Signal(EVENT e)
 }
 
 
-ISR(TIMER1_COMPA_vect)
+/**
+  * Posts a work item for the kernel. Meant for ISRs: it never enters the
+  * kernel itself, the next tick (or any system call) picks the item up.
+  */
+static int defer(DEFERRED_WORK_TYPE type, int arg, void (*callback)(int))
 {
 	uint8_t sreg;
-	volatile PD* curr;
-	curr = sleep_queue.head;
-	while(curr!= NULL){
-		if(curr->tick!=0){
-			curr->tick--;
+	uint8_t next;
+	int posted=0;
+
+	sreg=SREG;
+	Disable_Interrupt();
+	next=(deferred_tail+1)%MAXDEFERRED;
+	if(next==deferred_head){
+		if(deferred_overflow!=0xFF){
+			++deferred_overflow;
 		}
-		curr = curr->next;
 	}
-	if(sleep_queue.head!=NULL){
-		if(sleep_queue.head->tick == 0)
-		{
-			sreg = SREG;
+	else{
+		deferred_queue[deferred_tail].type=type;
+		deferred_queue[deferred_tail].arg=arg;
+		deferred_queue[deferred_tail].callback=callback;
+		deferred_tail=next;
+		posted=1;
+	}
+	SREG=sreg;
+	return posted;
+}
+
+int Defer_Event_Signal(EVENT e)
+{
+	return defer(DEFER_SIGNAL,e,NULL);
+}
+
+int Defer_Task_Resume(PID p)
+{
+	return defer(DEFER_RESUME,p,NULL);
+}
+
+/**
+  * Like Task_Notify(), for ISRs: the bits change at once, only the wake-up of
+  * a waiting task is deferred. Returns 0 if p is no task or that wake-up
+  * could not be queued.
+  */
+int Defer_Task_Notify(PID p, unsigned char bits, NOTIFY_ACTION action)
+{
+	uint8_t sreg;
+	int wake;
+
+	if(p>=MAXPROCESS){
+		return 0;
+	}
+	sreg=SREG;
+	Disable_Interrupt();
+	if(Process[p].state==DEAD){
+		SREG=sreg;
+		return 0;
+	}
+	wake=notify_update(&Process[p],bits,action);
+	SREG=sreg;
+	return wake?defer(DEFER_NOTIFY,p,NULL):1;
+}
+
+int Defer_Call(void (*f)(int), int arg)
+{
+	return defer(DEFER_CALLBACK,arg,f);
+}
+
+unsigned char OS_GetDeferredOverflow(void)
+{
+	return deferred_overflow;
+}
+
+#if MAXBASIC > 0
+int Defer_Basic_Activate(BASIC_TASK b)
+{
+	return defer(DEFER_ACTIVATE,b,NULL);
+}
+
+BASIC_TASK Basic_Create(voidfuncptr f, PRIORITY py)
+{
+	uint8_t sreg;
+	BASIC_TASK b;
+
+	sreg=SREG;
+	Disable_Interrupt();
+	if(num_basic==MAXBASIC){
+		SREG=sreg;
+		error_msg=ERR_1_TOO_MANY_TASK;
+		OS_Abort();
+		return -1;
+	}
+	if(py>MINPRIORITY){
+		SREG=sreg;
+		error_msg=ERR_8_NO_SUCH_PRIORITY;
+		OS_Abort();
+		return -1;
+	}
+	b=num_basic++;
+	BasicTask[b].code=f;
+	BasicTask[b].priority=py;
+	BasicTask[b].pending=0;
+	BasicTask[b].lc=0;
+	BasicTask[b].wait=PT_NONE;
+	BasicTask[b].next=NO_BASIC;
+	SREG=sreg;
+	return b;
+}
+
+BASIC_TASK Pt_Create(voidfuncptr f, PRIORITY py)
+{
+	BASIC_TASK b=Basic_Create(f,py);
+
+	Basic_Activate(b);
+	return b;
+}
+
+/* The running protothread is always the innermost entry on the shared stack. */
+unsigned int* Pt_Lc(void)
+{
+	return &BasicTask[basic_nest[basic_depth-1].task].lc;
+}
+
+void Pt_Wait_Event(EVENT e)
+{
+	volatile BD* b=&BasicTask[basic_nest[basic_depth-1].task];
+	if(e>=num_events_created){
+		//no such event; like Event_Wait(), do not wait for it
+		OS_Abort();
+		b->wait=PT_YIELDED;
+		return;
+	}
+	b->event=e;
+	b->wait=PT_EVENT;
+}
+
+void Pt_Sleep(TICK t)
+{
+	volatile BD* b=&BasicTask[basic_nest[basic_depth-1].task];
+	b->wake=OS_GetTicks()+(t?t:1);
+	b->wait=PT_SLEEP;
+}
+
+void Pt_Yield(void)
+{
+	BasicTask[basic_nest[basic_depth-1].task].wait=PT_YIELDED;
+}
+
+void Basic_Activate(BASIC_TASK b)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	if(KernelActive){
+		Cp->request = ACTIVATE;
+		kernel_request_basic = b;
+		Enter_Kernel();
+	}
+	else if(b>=num_basic){
+		SREG=sreg;
+		error_msg=ERR_3_NO_SUCH_TASK;
+		OS_Abort();
+		return;
+	}
+	else{
+		/* OS_Start() runs it first thing */
+		basic_pend(b);
+	}
+	SREG=sreg;
+}
+#endif
+
+#if MAXTIMER > 0
+/**
+  * Inserts a timer into the delta list to expire ticks from now. Interrupts
+  * must be disabled.
+  */
+static void timer_insert(volatile TD* t, TICK ticks)
+{
+	volatile TD* curr = timer_list;
+	volatile TD* prev = NULL;
+
+	t->expires=os_ticks+ticks;
+	while(curr!=NULL&&curr->delta<=ticks){
+		ticks-=curr->delta;
+		prev=curr;
+		curr=curr->next;
+	}
+	t->delta=ticks;
+	t->next=curr;
+	if(curr!=NULL){
+		curr->delta-=ticks;
+	}
+	if(prev==NULL){
+		timer_list=t;
+	}
+	else{
+		prev->next=t;
+	}
+	t->active=1;
+}
+
+/**
+  * Unlinks a running timer, handing its delta on to its successor.
+  * Interrupts must be disabled.
+  */
+static void timer_remove(volatile TD* t)
+{
+	volatile TD* curr = timer_list;
+	volatile TD* prev = NULL;
+
+	while(curr!=NULL&&curr!=t){
+		prev=curr;
+		curr=curr->next;
+	}
+	if(curr==NULL){
+		return;
+	}
+	if(t->next!=NULL){
+		t->next->delta+=t->delta;
+	}
+	if(prev==NULL){
+		timer_list=t->next;
+	}
+	else{
+		prev->next=t->next;
+	}
+	t->next=NULL;
+	t->active=0;
+}
+
+/**
+  * Runs the callbacks of every expired timer, re-arming the periodic ones,
+  * then waits for the tick to report the next expiry.
+  */
+static void timer_service(void)
+{
+	uint8_t sreg;
+	volatile TD* t;
+	TICK next;
+
+	for(;;){
+		Event_Wait(timer_event);
+		for(;;){
+			sreg=SREG;
 			Disable_Interrupt();
-			Cp->request = WAKE;
-			Enter_Kernel();
+			t=timer_list;
+			if(t==NULL||t->delta!=0){
+				SREG=sreg;
+				break;
+			}
+			timer_list=t->next;
+			t->next=NULL;
+			t->active=0;
+			if(!t->one_shot){
+				/* a period after the last expiry, however late this runs;
+				   at once if that has passed too */
+				next=t->expires+t->period;
+				timer_insert(t,TICK_BEFORE(os_ticks,next)?next-os_ticks:0);
+			}
+			SREG=sreg;
+			t->callback();
+		}
+	}
+}
+
+TIMER Timer_Create(TICK period, int one_shot, void (*callback)(void))
+{
+	uint8_t sreg;
+	uint8_t start;
+	int x;
+
+	sreg=SREG;
+	Disable_Interrupt();
+	start=!timer_service_started;
+	if(start){
+		if(num_events_created>=MAXEVENT){
+			/* no event left for timer_service() to wait on */
+			SREG=sreg;
+			error_msg=ERR_5_TOO_MANY_TIMER;
+			OS_Abort();
+			return -1;
+		}
+		timer_event=num_events_created++;
+		timer_service_started=1;
+	}
+	for(x=0;x<MAXTIMER;x++){
+		if(!Timer[x].allocated){
+			Timer[x].allocated=1;
+			Timer[x].active=0;
+			Timer[x].one_shot=one_shot?1:0;
+			Timer[x].period=period?period:1;
+			Timer[x].callback=callback;
+			Timer[x].next=NULL;
 			SREG=sreg;
+			if(start){
+				Task_Create(timer_service,TIMER_SERVICE_PRIORITY,0);
+			}
+			return x;
+		}
+	}
+	SREG=sreg;
+	/*Too Many Timers*/
+	error_msg=ERR_5_TOO_MANY_TIMER;
+	OS_Abort();
+	return -1;
+}
+
+void Timer_Start(TIMER t)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	if(!Timer[t].active){
+		timer_insert(&Timer[t],Timer[t].period);
+	}
+	SREG=sreg;
+}
+
+void Timer_Stop(TIMER t)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	if(Timer[t].active){
+		timer_remove(&Timer[t]);
+	}
+	SREG=sreg;
+}
+
+void Timer_Reset(TIMER t)
+{
+	uint8_t sreg;
+	sreg=SREG;
+	Disable_Interrupt();
+	if(Timer[t].active){
+		timer_remove(&Timer[t]);
+	}
+	timer_insert(&Timer[t],Timer[t].period);
+	SREG=sreg;
+}
+
+/**
+  * Called from the tick. Only the first unexpired timer is decremented, the
+  * others are relative to it; expired timers wait at delta 0 for the service.
+  */
+static void timer_tick(void)
+{
+	volatile TD* t = timer_list;
+
+	while(t!=NULL&&t->delta==0){
+		t=t->next;
+	}
+	if(t!=NULL&&--t->delta==0){
+		defer(DEFER_SIGNAL,timer_event,NULL);
+	}
+}
+#endif
+
+#if TASK_BUDGETS
+/**
+  * Charge this tick to the task it interrupted, first refilling its budget if
+  * a new period has begun, and have the kernel throttle it once the budget is
+  * spent. While tasks are throttled, also hand those whose period has ended
+  * back to the kernel; a post the deferred queue had no room for is simply
+  * made again on the next tick.
+  */
+static void budget_tick(void)
+{
+	BUDGET* b;
+	uint8_t i;
+
+	/* the idle task and basic_runner have no budget */
+	if(Cp->pid<MAXPROCESS&&Budget[Cp->pid].budget!=0&&!Budget[Cp->pid].throttled){
+		b=&Budget[Cp->pid];
+		++b->used;
+		if(!TICK_BEFORE(os_ticks,b->next)){
+			b->left=b->budget;
+			b->next=os_ticks+b->period;
+		}
+		if(b->left!=0){
+			--b->left;
+		}
+		if(b->left==0){
+			defer(DEFER_THROTTLE,Cp->pid,NULL);
+		}
+	}
+	if(budget_throttled){
+		for(i=0;i<MAXPROCESS;i++){
+			if(Budget[i].throttled&&!TICK_BEFORE(os_ticks,Budget[i].next)){
+				defer(DEFER_REPLENISH,i,NULL);
+			}
+		}
+	}
+}
+#endif
+
+#if MAXSERVER > 0
+/**
+  * Post again the wake-ups of servers that Defer_Server_Post() could not fit
+  * in the deferred queue; one that still does not fit waits for the next tick.
+  */
+static void server_tick(void)
+{
+	uint8_t x;
+
+	server_wake_lost=0;
+	for(x=0;x<MAXSERVER;x++){
+		if(Server[x].wake_lost){
+			if(defer(DEFER_NOTIFY,Server[x].pid,NULL)){
+				Server[x].wake_lost=0;
+			}
+			else{
+				server_wake_lost=1;
+			}
 		}
-	}		
+	}
+}
+#endif
+
+/**
+  * The tick enters the kernel at most once, and only when a sleeper is due or
+  * some ISR has posted deferred work; all of it is handled in that one entry.
+  */
+ISR(TIMER1_COMPA_vect)
+{
+	wheel_tick();
+#if MAXTIMER > 0
+	timer_tick();
+#endif
+#if TASK_BUDGETS
+	budget_tick();
+#endif
+#if MAXSERVER > 0
+	if(server_wake_lost){
+		server_tick();
+	}
+#endif
+	if(expired_list!=NULL||deferred_head!=deferred_tail
+#if MAXBASIC > 0
+		||pt_expired!=NO_BASIC
+#endif
+		)
+	{
+		Cp->request = WAKE;
+		Enter_Kernel();
+	}
 }
 
 int main() 
 {
    OS_Init();
+#ifndef OS_STATIC_TASKS
    Task_Create( a_main , 0, 0 );
+#endif
    OS_Start();
 }
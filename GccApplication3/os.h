@@ -1,12 +1,135 @@
 #ifndef _OS_H_  
 #define _OS_H_  
+
+#include "os_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
    
-#define MAXTHREAD     16       
+#ifndef MAXTHREAD
+#define MAXTHREAD     16   // up to 64, as far as OS_SRAM_LIMIT allows
+#endif
 #define WORKSPACE     256   // in bytes, per THREAD
-#define MAXMUTEX      8 
-#define MAXEVENT      8      
+#ifndef MAXMUTEX
+#define MAXMUTEX      8    // 0 removes the mutex service
+#endif
+#ifndef MAXCOND
+#if MAXMUTEX > 0
+#define MAXCOND       4    // condition variables, 0 removes them
+#else
+#define MAXCOND       0
+#endif
+#endif
+#if MAXCOND > 0 && MAXMUTEX == 0
+#error "condition variables need mutexes, MAXCOND must be 0 when MAXMUTEX is"
+#endif
+#ifndef MSG_PASSING
+#define MSG_PASSING   1    // 0 removes Msg_Send/Msg_Receive/Msg_Reply
+#endif
+#ifndef TASK_BUDGETS
+#define TASK_BUDGETS  0    // 1 enables Task_SetBudget() CPU budgets, charged by the tick
+#endif
+#ifndef MAXSERVER
+#if TASK_BUDGETS
+#define MAXSERVER     2    // aperiodic servers, 0 removes them
+#else
+#define MAXSERVER     0
+#endif
+#endif
+#if MAXSERVER > 0 && !TASK_BUDGETS
+#error "servers run on a CPU budget, MAXSERVER must be 0 unless TASK_BUDGETS is 1"
+#endif
+#define SERVER_QUEUE  8    // jobs a server holds before Server_Post() fails
+#ifndef MAXRWLOCK
+#define MAXRWLOCK     4    // reader-writer locks, 0 removes them
+#endif
+#define RWLOCK_READERS 6   // readers that may hold one lock at once
+#ifndef DEADLOCK_CHECK
+#define DEADLOCK_CHECK 0   // on a contended Mutex_Lock: 0 no check, 1 refuse a deadlocking lock, 2 abort
+#endif
+#ifndef MAXEVENT
+#define MAXEVENT      8    // at least 1
+#endif
+#define MAXDEFERRED   8    // deferred work items ISRs may post between kernel entries
+#ifndef MAXTIMER
+#define MAXTIMER      8    // software timers, 0 removes the timer service task
+#endif
+#define TIMER_SERVICE_PRIORITY 0   // priority of the task that runs timer callbacks
+#ifndef MAXBASIC
+#define MAXBASIC      8    // basic tasks plus protothreads (up to 254), 0 removes both
+#endif
+#define BASICSTACK    512  // bytes of the stack shared by all basic tasks
+#ifndef TASKPOOL_PREWARM
+#define TASKPOOL_PREWARM 0 // TaskPool_Acquire() workers created, parked, by OS_Init
+#endif
+//#define OS_STACK_CANARY  // check the bottom bytes of each stack on every kernel entry
+#define STACK_CANARY  0xA5
+//#define OS_MUTEX_STATS   // per-mutex acquisition, wait and hold time counters
+//#define OS_SWITCH_STATS  // count context switches, see OS_GetSwitches()
+#ifndef F_CPU
+#define F_CPU         16000000UL
+#endif
+#define STATS_BAUD    38400 // USART0 speed of Mutex_DumpStats()
 #define MSECPERTICK   10   // resolution of a system tick in milliseconds
 #define MINPRIORITY   10   // 0 is the highest priority, 10 the lowest
+#define NO_PRIORITY   0xFF // PD::past when the task has not inherited a priority, PD::threshold when it has none
+
+#define WHEEL_BITS    4    // slots per timing wheel level = 1<<WHEEL_BITS
+#define WHEEL_LEVELS  ((32+WHEEL_BITS-1)/WHEEL_BITS)   // enough levels for a 32-bit TICK
+#define NO_SLOT       0xFF // PD::tslot when the task is not in the timing wheel
+
+/* Wraparound-safe comparisons of absolute TICK values. */
+#define TICK_BEFORE(a,b)   ((long)((TICK)(a)-(TICK)(b)) < 0)
+#define TICK_AFTER(a,b)    TICK_BEFORE(b,a)
+
+/*
+ * External SRAM option (ATmega2560 XMEM interface).
+ * Define OS_USE_XMEM to move the task workspaces out of the 8K internal SRAM.
+ * The process descriptors stay internal so the scheduler paths are not slowed
+ * by the external bus. Link with
+ *   -Wl,--section-start=.xmem=0x802200
+ * so the .xmem section starts right after internal SRAM.
+ */
+#if MAXTHREAD > 64
+#error "MAXTHREAD can be at most 64"
+#endif
+
+/*
+ * Internal SRAM the kernel's tables take with the options above, in bytes as
+ * avr-gcc -fshort-enums lays them out (see README.md): per task its PD,
+ * message state, budget and, unless OS_USE_XMEM, its stack; the idle task;
+ * then the fixed tables of each service. OS_SRAM_LIMIT keeps 1 KB of the
+ * 8 KB for .data, the application's own variables and the main stack.
+ */
+#define OS_SRAM_LIMIT   (8192-1024)
+#ifdef OS_USE_XMEM
+#define OS_SRAM_STACK   0
+#else
+#define OS_SRAM_STACK   WORKSPACE
+#endif
+#ifdef OS_MUTEX_STATS
+#define OS_SRAM_MUTEX   (9+25)
+#else
+#define OS_SRAM_MUTEX   9
+#endif
+#define OS_SRAM_TASK    (29 + OS_SRAM_STACK + (MSG_PASSING ? 12 : 0) + (TASK_BUDGETS ? 19 : 0))
+#define OS_SRAM_CORE    (29 + OS_SRAM_STACK + (MINPRIORITY+1)*4 + WHEEL_LEVELS*(1<<WHEEL_BITS)*2 \
+                         + MAXEVENT*6 + MAXDEFERRED*5)
+#define OS_SRAM_BASIC   ((MAXBASIC > 0) ? 29 + BASICSTACK + MAXBASIC*17 + (MINPRIORITY+1)*2 \
+                         + MAXEVENT + WHEEL_LEVELS*(1<<WHEEL_BITS) : 0)
+#define OS_SRAM_SERVICE (MAXTIMER*17 + MAXMUTEX*OS_SRAM_MUTEX + MAXRWLOCK*(12+2*RWLOCK_READERS) \
+                         + MAXCOND*6 + MAXSERVER*(5+4*SERVER_QUEUE))
+#define OS_SRAM_KERNEL  (MAXTHREAD*OS_SRAM_TASK + OS_SRAM_CORE + OS_SRAM_BASIC + OS_SRAM_SERVICE)
+#if OS_SRAM_KERNEL > OS_SRAM_LIMIT
+#error "the kernel tables do not fit in internal SRAM: define OS_USE_XMEM or lower MAXTHREAD or the service limits"
+#endif
+#if MAXEVENT < 1
+#error "MAXEVENT must be at least 1"
+#endif
+#if MAXBASIC > 254
+#error "MAXBASIC can be at most 254, NO_BASIC ends the protothread lists"
+#endif
 
 
 #ifndef NULL
@@ -17,8 +140,15 @@ typedef unsigned int PID;        // always non-zero if it is valid
 
 typedef unsigned char PRIORITY;
 typedef unsigned int EVENT;      // always non-zero if it is valid
-typedef unsigned int TICK;
+typedef unsigned long TICK;      // 32-bit, wraps after ~497 days at 10 ms
 typedef unsigned int MUTEX;
+typedef unsigned int TIMER;
+typedef unsigned int BASIC_TASK;
+typedef unsigned int RWLOCK;
+typedef unsigned int COND;
+typedef unsigned int SERVER;
+
+typedef void (*voidfuncptr) (void); 
 
 
 // void OS_Init(void);      redefined as main()
@@ -27,15 +157,122 @@ void OS_Abort(void);
 PID  Task_Create( void (*f)(void), PRIORITY py, int arg); //DONE
 void Task_Terminate(void); //DONE
 void Task_Yield(void);//DONE
+void Task_YieldTo(PID p);  // like Task_Yield, but p runs next if it is ready and nothing is more urgent
 int  Task_GetArg(void);//DONE
-void Task_Suspend( PID p );  //implement using mirrored states via suspension flag on process descriptor    
-void Task_Resume( PID p ); //implement  using mirrored states via suspension flag on process descriptor 
+PID  TaskPool_Acquire(voidfuncptr f, int arg);  // Task_Create at the caller's priority, reusing a parked worker
+unsigned long Task_CreateCycles(void);  // CPU cycles of the last Task_Create/TaskPool_Acquire
+void Task_Suspend( PID p );  //moves p onto the suspended list, out of the ready/sleep queues
+void Task_Resume( PID p ); //puts p back where it was suspended from (ready or sleep queue)
+void Task_SetPriority(PID p, PRIORITY py);  // new base priority; an inherited, more urgent one stays until released
+PRIORITY Task_GetPriority(PID p);           // base priority, NO_PRIORITY if p is no task
+/* Preemption threshold: while p runs, only tasks more urgent than t preempt
+   it, so tasks at priorities t..priority(p) run to completion against each
+   other. NO_PRIORITY (the default) makes the priority itself the threshold. */
+void Task_SetThreshold(PID p, PRIORITY t);
+/* Scheduler lock: between Sched_Lock() and Sched_Unlock() the caller is not
+   preempted by other tasks, while interrupts stay enabled and ISRs run as
+   usual. A reschedule that falls due meanwhile is done by the outermost
+   Sched_Unlock(). Calls nest. The caller must not block while it holds the
+   lock. */
+void Sched_Lock(void);
+void Sched_Unlock(void);
+
+/* CPU budgets. A task with a budget may run for that many ticks in each
+   period of its own; every tick that finds it running is charged to it. Once
+   the budget is spent the task is throttled until the period ends: demoted
+   to MINPRIORITY, with no preemption threshold, or suspended. A task holding
+   Sched_Lock() is only suspended once it unlocks. A budget of 0 (the
+   default) means no limit. */
+#if TASK_BUDGETS
+typedef enum budget_action
+{
+	BUDGET_DEMOTE = 0,
+	BUDGET_SUSPEND
+} BUDGET_ACTION;
+struct budget_stat
+{
+	unsigned long used;        /* ticks charged since Task_SetBudget() */
+	unsigned int overruns;     /* periods in which the budget ran out */
+	unsigned int left;         /* ticks left in this period */
+	unsigned char throttled;   /* 1 while demoted or suspended for overrunning */
+};
+void Task_SetBudget(PID p, unsigned int budget, unsigned int period, BUDGET_ACTION action);
+void Task_GetBudgetStats(PID p, struct budget_stat* s);
+#endif
+
+/* Deferrable servers for aperiodic work. A server is a task that runs the
+   jobs posted to it, in order, at priority py, for at most capacity ticks in
+   each period; then it is suspended until the period ends. A burst of
+   ISR-driven jobs thus takes at most capacity/period of the CPU from the
+   tasks below the server. Capacity a period does not use is kept for jobs
+   posted later in that period. */
+#if MAXSERVER > 0
+SERVER Server_Create(PRIORITY py, unsigned int capacity, unsigned int period);
+int  Server_Post(SERVER s, void (*f)(int), int arg);         // 0 if its queue is full
+int  Defer_Server_Post(SERVER s, void (*f)(int), int arg);   // from an ISR, 0 if its queue is full
+PID  Server_GetPid(SERVER s);   // for Task_GetBudgetStats()
+#endif
+#ifdef OS_SWITCH_STATS
+unsigned long OS_GetSwitches(void);   // context switches since OS_Start
+#endif
 
 void Task_Sleep(TICK t);  // GOUDINE
+TICK OS_GetTicks(void);   // ticks since OS_Start, wraps around
 
+#if MAXMUTEX > 0
+struct mutex_stat;
 MUTEX Mutex_Init(void); //Do mutex at end.
-void Mutex_Lock(MUTEX m);
+int  Mutex_Lock(MUTEX m);   // 1 when held; 0 when waiting would deadlock (DEADLOCK_CHECK 1)
 void Mutex_Unlock(MUTEX m);
+#if DEADLOCK_CHECK
+const struct deadlock_report* Mutex_GetDeadlock(void);   // the last cycle found
+#endif
+#ifdef OS_MUTEX_STATS
+void Mutex_GetStats(MUTEX m, struct mutex_stat* stat);  // a consistent copy of the counters of m
+void Mutex_DumpStats(void);   // one line per initialized mutex to USART0, polled
+#endif
+#endif
+
+/* Condition variables. Cond_Wait() gives up m, which the caller must hold
+   exactly once, and waits in the same kernel request; it returns with m
+   held again. All tasks waiting on c at a time must use the same m. */
+#if MAXCOND > 0
+COND Cond_Init(void);
+void Cond_Wait(COND c, MUTEX m);
+void Cond_Signal(COND c);      // wakes the most urgent waiter
+void Cond_Broadcast(COND c);   // wakes all waiters
+#endif
+
+/* Synchronous messages. Msg_Send() blocks until the receiver has replied and
+   returns the length of the reply, or -1 at once if p is no task; the
+   receiver runs at least at the priority of its most urgent sender
+   meanwhile. Messages are copied straight from the sender's buffer to the
+   receiver's and back, truncated to the shorter of the two. */
+#if MSG_PASSING
+int  Msg_Send(PID p, const void* req, unsigned char req_len, void* reply, unsigned char reply_len);
+int  Msg_Receive(PID* sender, void* buf, unsigned char len);   // returns the request length
+void Msg_Reply(PID sender, const void* reply, unsigned char len);
+#endif
+
+/* Reader-writer locks. Readers share the lock, a writer has it alone. A
+   waiting writer keeps new readers out, so writers wait at most for the
+   readers already holding it. Not recursive. */
+#if MAXRWLOCK > 0
+RWLOCK RWLock_Init(void);
+void RWLock_ReadLock(RWLOCK l);
+void RWLock_ReadUnlock(RWLOCK l);
+void RWLock_WriteLock(RWLOCK l);
+void RWLock_WriteUnlock(RWLOCK l);
+#endif
+
+/* Snapshots: a value one producer (task or ISR) publishes and any number
+   of readers copy out, without locks or kernel requests. See SNAPSHOT. */
+#define SNAPSHOT_DECLARE(name, type) \
+	static unsigned char name##_buf[2*sizeof(type)]; \
+	SNAPSHOT name = { 0, sizeof(type), name##_buf }
+struct snapshot;
+void Snapshot_Publish(struct snapshot* s, const void* data);
+void Snapshot_Read(struct snapshot* s, void* data);
 
 EVENT Event_Init(void);//Implement using event queue?
 void Event_Wait(EVENT e);
@@ -43,10 +280,109 @@ void Event_Signal(EVENT e);
 
 void preemption();
 
-typedef void (*voidfuncptr) (void); 
+/* Task notifications: 8 bits in each PD that other tasks and ISRs update
+   and the task waits on, a lighter one-to-one EVENT. Updating them only
+   enters the kernel when it wakes the task. */
+typedef enum notify_action
+{
+	NOTIFY_SET_BITS = 0,   // OR bits in
+	NOTIFY_INCREMENT,      // add 1 up to 255, bits unused; see Task_NotifyTake()
+	NOTIFY_OVERWRITE       // replace all 8 bits with bits
+} NOTIFY_ACTION;
+#define NOTIFY_FOREVER ((TICK)-1)   // Task_NotifyWait() without timeout
+void Task_Notify(PID p, unsigned char bits, NOTIFY_ACTION action);
+int  Defer_Task_Notify(PID p, unsigned char bits, NOTIFY_ACTION action);   // from an ISR
+/* Wait up to timeout ticks (0 does not wait) for one of mask to be set;
+   returns the bits of mask that were set, and clears them. */
+unsigned char Task_NotifyWait(unsigned char mask, TICK timeout);
+/* The notification as a counting semaphore: wait up to timeout ticks for the
+   value NOTIFY_INCREMENT counts up to be non-zero, then take 1 off it;
+   returns the value before the take, 0 on timeout. */
+unsigned char Task_NotifyTake(TICK timeout);
+
+/* Batches: several non-blocking operations in one kernel request. They are
+   applied in order with interrupts off, and the tasks they make ready compete
+   once, at the end, instead of after each operation. */
+typedef enum batch_op
+{
+	BATCH_SIGNAL = 0,   // Event_Signal(arg)
+	BATCH_UNLOCK,       // Mutex_Unlock(arg)
+	BATCH_RESUME,       // Task_Resume(arg)
+	BATCH_NOTIFY        // Task_Notify(arg, bits, NOTIFY_SET_BITS)
+} BATCH_OP;
+typedef struct kernel_op
+{
+	unsigned char op;     /* BATCH_OP */
+	unsigned char arg;    /* EVENT, MUTEX or PID */
+	unsigned char bits;   /* BATCH_NOTIFY only */
+} KERNEL_OP;
+void Kernel_Batch(const KERNEL_OP* ops, unsigned char n);
+/* KERNEL_BATCH({BATCH_SIGNAL, e1}, {BATCH_UNLOCK, m}) */
+#define KERNEL_BATCH(...) \
+	Kernel_Batch((const KERNEL_OP[]){__VA_ARGS__}, \
+		sizeof((const KERNEL_OP[]){__VA_ARGS__})/sizeof(KERNEL_OP))
+
+/* Deferred (bottom-half) kernel services for ISRs. They only post a work item;
+   the kernel applies all pending items in one batch before it next dispatches.
+   They return 1 if the item was queued, 0 if the deferred queue was full. */
+int Defer_Event_Signal(EVENT e);
+int Defer_Task_Resume(PID p);
+int Defer_Call(void (*f)(int), int arg);   // f runs in the kernel, must not call the OS API
+unsigned char OS_GetDeferredOverflow(void);   // items dropped on a full queue since reset, stops at 255
+
+/* Basic (run-to-completion) tasks. They all share one stack and never block:
+   a basic task must not call Task_Sleep, Mutex_Lock on a held mutex,
+   Event_Wait or the Msg_ calls. Activating one that is already running or
+   pending queues one more run. Higher-priority basic tasks nest on top of
+   lower ones. They run on a PD of their own, not one of the MAXTHREAD. */
+BASIC_TASK Basic_Create(voidfuncptr f, PRIORITY py);
+void Basic_Activate(BASIC_TASK b);
+int Defer_Basic_Activate(BASIC_TASK b);   // from an ISR, see Defer_Event_Signal
+
+/* Protothreads: stackless basic tasks that can wait (see pt.h for the
+   PT_BEGIN/PT_END macros). Pt_Create() also activates the protothread. The
+   Pt_ calls below only record the wait; the protothread must return right
+   after, which is what the pt.h macros do. */
+BASIC_TASK Pt_Create(voidfuncptr f, PRIORITY py);
+unsigned int* Pt_Lc(void);   // local continuation of the running protothread
+void Pt_Wait_Event(EVENT e);
+void Pt_Sleep(TICK t);
+void Pt_Yield(void);
+
+/* Software timers. Callbacks run one after another in the timer service task,
+   so they may use the OS API but should not block for long. The first
+   Timer_Create() creates that task, which then takes one MAXTHREAD slot and
+   one of the MAXEVENT events. */
+TIMER Timer_Create(TICK period, int one_shot, void (*callback)(void));
+void Timer_Start(TIMER t);   // arm if not already running
+void Timer_Stop(TIMER t);
+void Timer_Reset(TIMER t);   // (re)arm for a full period from now
+
 
 void a_main(void);
 
+/* Handles of the objects listed in os_config.h, see there. */
+#ifdef OS_STATIC_TASKS
+#define OS_STATIC_TASK_DECL(f,py,arg,size)  void f(void);
+#define OS_STATIC_TASK_PID(f,py,arg,size)   f##_PID,
+OS_STATIC_TASKS(OS_STATIC_TASK_DECL)
+enum { OS_STATIC_TASKS(OS_STATIC_TASK_PID) OS_STATIC_TASK_COUNT };
+#else
+enum { OS_STATIC_TASK_COUNT = 0 };
+#endif
+#ifdef OS_STATIC_MUTEXES
+#define OS_STATIC_MUTEX_ID(name)   name,
+enum { OS_STATIC_MUTEXES(OS_STATIC_MUTEX_ID) OS_STATIC_MUTEX_COUNT };
+#else
+enum { OS_STATIC_MUTEX_COUNT = 0 };
+#endif
+#ifdef OS_STATIC_EVENTS
+#define OS_STATIC_EVENT_ID(name)   name,
+enum { OS_STATIC_EVENTS(OS_STATIC_EVENT_ID) OS_STATIC_EVENT_COUNT };
+#else
+enum { OS_STATIC_EVENT_COUNT = 0 };
+#endif
+
 typedef enum mutex_states
 {
 	OPEN = 0,
@@ -55,6 +391,31 @@ typedef enum mutex_states
 } MUTEX_STATES;
 
 
+typedef enum deferred_work_type
+{
+	DEFER_SIGNAL = 0,
+	DEFER_RESUME,
+	DEFER_CALLBACK,
+#if MAXBASIC > 0
+	DEFER_ACTIVATE,
+#endif
+	DEFER_NOTIFY
+#if TASK_BUDGETS
+	,DEFER_THROTTLE,
+	DEFER_REPLENISH
+#endif
+} DEFERRED_WORK_TYPE;
+
+/** One work item posted by an ISR, see Defer_Event_Signal() and friends. */
+typedef struct deferred_work
+{
+	DEFERRED_WORK_TYPE type;
+	/** EVENT, PID or callback argument depending on type. */
+	int arg;
+	void (*callback)(int);
+}
+deferred_work;
+
 typedef struct create_args
 {
 	/** The code the new task is to run.*/
@@ -65,6 +426,8 @@ typedef struct create_args
 	PRIORITY py;
 	
 	PID pid;
+	/** TCNT1 when the request was made, for Task_CreateCycles(). */
+	unsigned int start;
 }
 create_args;
 /**
@@ -77,7 +440,8 @@ typedef enum process_states
    BLOCKED,
    RUNNING,
 	WAITING,
-   SLEEPING
+   SLEEPING,
+	SUSPENDED
 } PROCESS_STATES;
 
 /**
@@ -98,43 +462,150 @@ typedef enum kernel_request_type
 	EVENT_INIT,
 	EVENT_SIGNAL,
 	EVENT_WAIT,
-   WAKE
+   WAKE,
+	ACTIVATE,
+	BASIC_DONE,
+	POOL_ACQUIRE,
+	POOL_PARK,
+	READ_LOCK,
+	READ_UNLOCK,
+	WRITE_LOCK,
+	WRITE_UNLOCK,
+	COND_WAIT,
+	COND_SIGNAL,
+	COND_BROADCAST,
+	MSG_SEND,
+	MSG_RECEIVE,
+	MSG_REPLY,
+	NOTIFY,
+	NOTIFY_WAIT,
+	BATCH,
+	YIELD_TO,
+	SET_PRIORITY,
+	SET_THRESHOLD,
+	SCHED_UNLOCK,
+	SET_BUDGET
 } KERNEL_REQUEST_TYPE;
 
 typedef struct ProcessDescriptor PD;
 
+typedef struct
+{
+	/** The first item in the queue. NULL if the queue is empty. */
+	volatile PD*  head;
+	/** The last item in the queue. NULL if the queue is empty. */
+	volatile PD*  tail;
+}
+queue_t;
+
+/**
+  * The stack of each task lives in a separate workspace table in os.c (see
+  * OS_USE_XMEM), so a PD only carries the saved stack pointer.
+  */
 struct ProcessDescriptor 
 {
-   unsigned volatile char *sp;   /* stack pointer into the "workSpace" */
-   unsigned char workSpace[WORKSPACE]; 
-   PROCESS_STATES state;
+   unsigned volatile char *sp;   /* stack pointer into the task's workspace */
    voidfuncptr  code;   /* function to be executed as a task */
-   KERNEL_REQUEST_TYPE request;
+	volatile PD* next;
+	volatile PD* prev;
+	/* the ready, wait or suspend queue the task is linked into, so it can be
+	   unlinked in constant time; NULL when it is in none */
+	queue_t* queue;
+	/* timing wheel links, separate from next so a task can wait with a timeout */
+	volatile PD* tnext;
+	volatile PD* tprev;
 	
 	//Added by Brendan
-	TICK tick;
+	TICK tick;           /* wake-up time in the wheel; ticks left while suspended */
+	int arg;
 	PRIORITY priority;
-	PRIORITY past;
-	PID pid;
-	unsigned int arg;
-	unsigned int arg2;
-	unsigned int suspend;
-	volatile PD* next;
+	PRIORITY past;       /* priority before inheritance, or NO_PRIORITY */
+	PRIORITY threshold;  /* preemption threshold, or NO_PRIORITY */
+	unsigned char pid;
+	unsigned char tslot; /* level*(1<<WHEEL_BITS)+slot in the wheel, or NO_SLOT */
+	unsigned char notify;      /* notification bits, see Task_Notify() */
+	unsigned char notify_mask; /* bits Task_NotifyWait() waits for, 0 if not waiting */
+	unsigned int state:3;     /* PROCESS_STATES */
+	unsigned int suspend:1;
+	unsigned int request:6;   /* KERNEL_REQUEST_TYPE, at most 64 requests */
+	unsigned int deadlock:1;  /* the last Mutex_Lock() was refused, see DEADLOCK_CHECK */
 };
 
-typedef struct
+
+
+typedef enum pt_wait
 {
-	/** The first item in the queue. NULL if the queue is empty. */
-	volatile PD*  head;
-	/** The last item in the queue. Undefined if the queue is empty. */
-	volatile PD*  tail;
+	PT_NONE = 0,
+	PT_EVENT,
+	PT_SLEEP,
+	PT_YIELDED
+} PT_WAIT;
+
+#define NO_BASIC      0xFF // end of a protothread wait list
+
+typedef struct Basic_Descriptor
+{
+	voidfuncptr code;
+	PRIORITY priority;
+	/** Activations waiting for their turn on the shared stack. */
+	unsigned char pending;
+	/* protothread state, unused by plain basic tasks */
+	unsigned int lc;          /* local continuation, 0 = start */
+	unsigned char wait;       /* PT_WAIT recorded before returning */
+	unsigned char event;      /* EVENT waited on with PT_EVENT */
+	unsigned char next;       /* next in an event or sleep wait list, or NO_BASIC */
+	unsigned char pnext;      /* next with pending activations at its priority */
+	TICK wake;                /* wake-up time with PT_SLEEP */
 }
-queue_t;
+BD;
 
+typedef struct Timer_Descriptor TD;
+
+struct Timer_Descriptor
+{
+	void (*callback)(void);
+	TICK period;
+	/** Ticks after the previous timer in the active list expires (delta list). */
+	TICK delta;
+	/** os_ticks at which it expires, or last expired. */
+	TICK expires;
+	unsigned char allocated:1;
+	unsigned char active:1;
+	unsigned char one_shot:1;
+	volatile TD* next;
+};
 
 typedef struct Mutex_Descriptor MD;
 
-typedef struct Mutex_Descriptor
+/**
+  * A wait-for cycle found by Mutex_Lock(): task pid[i] waits for mutex[i],
+  * which task pid[i+1] holds; the last mutex is held by pid[0], the task
+  * whose Mutex_Lock() closed the cycle.
+  */
+struct deadlock_report
+{
+	unsigned char length;
+	unsigned char pid[MAXMUTEX];
+	unsigned char mutex[MAXMUTEX];
+};
+
+/**
+  * Counters of one mutex, see OS_MUTEX_STATS. Times are in TIMER1 counts,
+  * F_CPU/8, i.e. 0.5 us at 16 MHz. Recursive locks by the owner are not
+  * counted; the hold time runs from the first lock to the last unlock.
+  */
+struct mutex_stat
+{
+	unsigned int acquisitions;
+	unsigned int contended;    /* acquisitions that had to wait */
+	unsigned long wait_total;
+	unsigned long wait_max;
+	unsigned long hold_total;
+	unsigned long hold_max;
+	unsigned char max_holder;  /* pid of the task that held it for hold_max */
+};
+
+struct Mutex_Descriptor
 {
 	MUTEX_STATES state;
 	volatile PD* owner;
@@ -142,4 +613,100 @@ typedef struct Mutex_Descriptor
 	volatile unsigned int count;
 };
 
+typedef enum msg_states
+{
+	MSG_IDLE = 0,
+	MSG_RECEIVING,   /* in Msg_Receive(), nothing was sent yet */
+	MSG_REPLY_WAIT   /* sent, received, not replied to yet */
+} MSG_STATES;
+
+/**
+  * The message side of a task, kept apart from the PD and indexed by pid.
+  * The caller fills in its own entry before the request, so the kernel needs
+  * no argument globals for it.
+  */
+typedef struct msg_descriptor
+{
+	unsigned char* buf;        /* sender: the request; receiver: where it goes */
+	unsigned char* reply;      /* sender: where the reply goes */
+	unsigned char len;         /* bytes at buf; on return, bytes copied */
+	unsigned char reply_len;   /* bytes at reply; on return, bytes copied */
+	unsigned char partner;     /* sender: its receiver; receiver: its last sender */
+	unsigned char state;       /* MSG_STATES */
+} MSGD;
+
+#if TASK_BUDGETS
+/**
+  * The CPU budget of a task, kept apart from the PD and indexed by pid.
+  */
+typedef struct budget_descriptor
+{
+	unsigned int budget;       /* ticks per period, 0 for no limit */
+	unsigned int period;
+	unsigned int left;
+	TICK next;                 /* start of the next period */
+	unsigned long used;
+	unsigned int overruns;
+	PRIORITY base;             /* base priority before a BUDGET_DEMOTE */
+	PRIORITY threshold;        /* preemption threshold before a BUDGET_DEMOTE */
+	unsigned char action:1;    /* BUDGET_ACTION */
+	unsigned char throttled:1;
+	unsigned char suspended:1; /* throttled by suspending, not by the user */
+} BUDGET;
+#endif
+
+#if MAXSERVER > 0
+typedef struct server_job
+{
+	void (*f)(int);
+	int arg;
+} SERVER_JOB;
+
+/**
+  * An aperiodic server: its task and the jobs posted to it, oldest at head.
+  */
+typedef struct server_descriptor
+{
+	unsigned char allocated;
+	PID pid;
+	unsigned char head;
+	unsigned char count;
+	unsigned char wake_lost;   /* its wake-up did not fit in the deferred queue */
+	SERVER_JOB job[SERVER_QUEUE];
+} SD;
+#endif
+
+/**
+  * A reader-writer lock. Waiting readers and writers are queued by priority,
+  * like Mutex_Descriptor::mutex_queue.
+  */
+typedef struct RWLock_Descriptor
+{
+	unsigned char allocated;
+	unsigned char readers;     /* tasks in reader[] */
+	volatile PD* writer;       /* the task holding it for writing, or NULL */
+	volatile PD* reader[RWLOCK_READERS];   /* tasks holding it for reading */
+	queue_t read_queue;
+	queue_t write_queue;
+} RWD;
+
+/**
+  * A double-buffered seqlock. seq counts publishes twice: it is odd while a
+  * publish is being written. Readers copy the buffer of the last complete
+  * publish while the producer writes the other one, so a producer preempted
+  * halfway never holds readers up; a reader only copies again if two more
+  * publishes started during its copy. seq is one byte, so reading it is
+  * atomic on the AVR. Only one producer per snapshot.
+  */
+typedef struct snapshot
+{
+	volatile unsigned char seq;
+	unsigned char size;        /* bytes in one buffer, at most 255 */
+	unsigned char* buf;        /* two buffers of size bytes */
+} SNAPSHOT;
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _OS_H_ */
@@ -0,0 +1,309 @@
+#ifndef _OS_HPP_
+#define _OS_HPP_
+
+/*
+ * Header-only C++ layer over os.h.
+ *
+ * Every member is an inline forward to the C call it names, with the handle
+ * as the only data member, so a class costs what the raw handle costs and
+ * each call compiles to the same kernel request as the C API. Nothing here
+ * allocates or needs the C++ runtime (no new/delete, exceptions or RTTI), so
+ * it builds with -fno-exceptions -fno-rtti and without libstdc++.
+ *
+ * Objects that need a kernel handle (Mutex, Cond, RWLock, Event, Queue) get
+ * it from init(), which must run in a task: like Mutex_Init() and
+ * Event_Init(), it is a kernel request and so cannot run from a global
+ * constructor.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "os.h"
+
+namespace os {
+
+/* Interrupts off for the lifetime of the object, restored as they were. */
+class CriticalSection
+{
+public:
+	CriticalSection() : sreg_(SREG) { cli(); }
+	~CriticalSection() { asm volatile ("" ::: "memory"); SREG = sreg_; }
+private:
+	CriticalSection(const CriticalSection&);
+	CriticalSection& operator=(const CriticalSection&);
+	uint8_t sreg_;
+};
+
+/* No other task runs for the lifetime of the object; interrupts stay on. */
+class SchedLock
+{
+public:
+	SchedLock() { Sched_Lock(); }
+	~SchedLock() { Sched_Unlock(); }
+private:
+	SchedLock(const SchedLock&);
+	SchedLock& operator=(const SchedLock&);
+};
+
+/* What Task_Create() takes, fixed at compile time. */
+struct TaskDesc
+{
+	constexpr TaskDesc(voidfuncptr f, PRIORITY py, int arg = 0)
+		: code(f), priority(py), arg(arg) {}
+	voidfuncptr code;
+	PRIORITY priority;
+	int arg;
+};
+
+class Task
+{
+public:
+	constexpr explicit Task(PID pid) : pid_(pid) {}
+
+	static Task create(const TaskDesc& d) { return Task(Task_Create(d.code, d.priority, d.arg)); }
+	static Task create(voidfuncptr f, PRIORITY py, int arg = 0) { return Task(Task_Create(f, py, arg)); }
+	static Task acquire(voidfuncptr f, int arg = 0) { return Task(TaskPool_Acquire(f, arg)); }
+
+	/* Calls on the running task. */
+	static void yield() { Task_Yield(); }
+	static void sleep(TICK t) { Task_Sleep(t); }
+	static void terminate() { Task_Terminate(); }
+	static int arg() { return Task_GetArg(); }
+
+	void suspend() const { Task_Suspend(pid_); }
+	void resume() const { Task_Resume(pid_); }
+	void set_priority(PRIORITY py) const { Task_SetPriority(pid_, py); }
+	PRIORITY priority() const { return Task_GetPriority(pid_); }
+	void set_threshold(PRIORITY t) const { Task_SetThreshold(pid_, t); }
+	constexpr PID pid() const { return pid_; }
+
+private:
+	PID pid_;
+};
+
+#if MAXMUTEX > 0
+class Mutex
+{
+public:
+	Mutex() : m_(0) {}
+	constexpr explicit Mutex(MUTEX m) : m_(m) {}   // e.g. a handle from os_config.h
+
+	void init() { m_ = Mutex_Init(); }
+	int lock() { return Mutex_Lock(m_); }
+	void unlock() { Mutex_Unlock(m_); }
+	constexpr MUTEX handle() const { return m_; }
+
+private:
+	MUTEX m_;
+};
+
+#if MAXCOND > 0
+class Cond
+{
+public:
+	Cond() : c_(0) {}
+
+	void init() { c_ = Cond_Init(); }
+	void wait(Mutex& m) { Cond_Wait(c_, m.handle()); }
+	void signal() { Cond_Signal(c_); }
+	void broadcast() { Cond_Broadcast(c_); }
+
+private:
+	COND c_;
+};
+#endif
+
+/* Holds m from construction to the end of the enclosing scope. */
+class LockGuard
+{
+public:
+	explicit LockGuard(Mutex& m) : m_(m) { m_.lock(); }
+	~LockGuard() { m_.unlock(); }
+private:
+	LockGuard(const LockGuard&);
+	LockGuard& operator=(const LockGuard&);
+	Mutex& m_;
+};
+#endif
+
+#if MAXRWLOCK > 0
+class RWLock
+{
+public:
+	RWLock() : l_(0) {}
+
+	void init() { l_ = RWLock_Init(); }
+	void read_lock() { RWLock_ReadLock(l_); }
+	void read_unlock() { RWLock_ReadUnlock(l_); }
+	void write_lock() { RWLock_WriteLock(l_); }
+	void write_unlock() { RWLock_WriteUnlock(l_); }
+
+private:
+	RWLOCK l_;
+};
+
+class ReadGuard
+{
+public:
+	explicit ReadGuard(RWLock& l) : l_(l) { l_.read_lock(); }
+	~ReadGuard() { l_.read_unlock(); }
+private:
+	ReadGuard(const ReadGuard&);
+	ReadGuard& operator=(const ReadGuard&);
+	RWLock& l_;
+};
+
+class WriteGuard
+{
+public:
+	explicit WriteGuard(RWLock& l) : l_(l) { l_.write_lock(); }
+	~WriteGuard() { l_.write_unlock(); }
+private:
+	WriteGuard(const WriteGuard&);
+	WriteGuard& operator=(const WriteGuard&);
+	RWLock& l_;
+};
+#endif
+
+class Event
+{
+public:
+	Event() : e_(0) {}
+	constexpr explicit Event(EVENT e) : e_(e) {}
+
+	void init() { e_ = Event_Init(); }
+	void wait() { Event_Wait(e_); }
+	void signal() { Event_Signal(e_); }
+	int signal_from_isr() { return Defer_Event_Signal(e_); }
+	constexpr EVENT handle() const { return e_; }
+
+private:
+	EVENT e_;
+};
+
+/* A T one producer publishes and readers copy, lock-free; see SNAPSHOT. */
+template<typename T>
+class Snapshot
+{
+	static_assert(sizeof(T) <= 255, "Snapshot<T> holds at most 255 bytes");
+
+public:
+	Snapshot() { s_.seq = 0; s_.size = sizeof(T); s_.buf = buf_; }
+
+	void publish(const T& v) { Snapshot_Publish(&s_, &v); }
+	T read() { T v; Snapshot_Read(&s_, &v); return v; }
+
+private:
+	Snapshot(const Snapshot&);
+	Snapshot& operator=(const Snapshot&);
+	SNAPSHOT s_;
+	unsigned char buf_[2 * sizeof(T)];
+};
+
+/*
+ * Bounded FIFO of N values of T, storage inline. The try_ calls never block
+ * and may be used from an ISR. send()/receive() block on an event while the
+ * queue is full/empty, for one sending and one receiving task (Event_Wait()
+ * takes one waiter per event).
+ */
+template<typename T, unsigned char N>
+class Queue
+{
+public:
+	Queue() : head_(0), count_(0) {}
+
+	void init() { not_empty_.init(); not_full_.init(); }
+
+	bool try_send(const T& v)
+	{
+		CriticalSection cs;
+		if (count_ == N) return false;
+		buf_[(unsigned char)(head_ + count_) % N] = v;
+		++count_;
+		return true;
+	}
+
+	bool try_receive(T& v)
+	{
+		CriticalSection cs;
+		if (count_ == 0) return false;
+		v = buf_[head_];
+		head_ = (unsigned char)(head_ + 1) % N;
+		--count_;
+		return true;
+	}
+
+	void send(const T& v)
+	{
+		while (!try_send(v)) not_full_.wait();
+		not_empty_.signal();
+	}
+
+	void receive(T& v)
+	{
+		while (!try_receive(v)) not_empty_.wait();
+		not_full_.signal();
+	}
+
+	unsigned char size() const { return count_; }
+	static constexpr unsigned char capacity() { return N; }
+
+private:
+	T buf_[N];
+	volatile unsigned char head_;
+	volatile unsigned char count_;
+	Event not_empty_;
+	Event not_full_;
+};
+
+/*
+ * N blocks of T, storage inline, handed out and taken back in O(1). T must be
+ * trivial: blocks are raw storage and no constructor or destructor runs.
+ * Safe from an ISR.
+ */
+template<typename T, unsigned char N>
+class Pool
+{
+	static_assert(__is_trivial(T), "Pool<T,N> only holds trivial types");
+	static_assert(N < 0xFF, "Pool<T,N> holds at most 254 blocks");
+
+	union Block
+	{
+		T value;
+		unsigned char next;
+	};
+
+public:
+	Pool() : free_(0)
+	{
+		for (unsigned char i = 0; i < N; i++) blocks_[i].next = i + 1;
+	}
+
+	/* NULL when all N blocks are taken. */
+	T* acquire()
+	{
+		CriticalSection cs;
+		if (free_ == N) return NULL;
+		Block* b = &blocks_[free_];
+		free_ = b->next;
+		return &b->value;
+	}
+
+	void release(T* p)
+	{
+		CriticalSection cs;
+		Block* b = reinterpret_cast<Block*>(p);
+		b->next = free_;
+		free_ = (unsigned char)(b - blocks_);
+	}
+
+	static constexpr unsigned char capacity() { return N; }
+
+private:
+	Block blocks_[N];
+	unsigned char free_;
+};
+
+} // namespace os
+
+#endif /* _OS_HPP_ */
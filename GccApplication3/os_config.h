@@ -0,0 +1,42 @@
+#ifndef _OS_CONFIG_H_
+#define _OS_CONFIG_H_
+
+/*
+ * Static (compile-time) system configuration.
+ *
+ * Tasks, mutexes and events listed here exist before OS_Start() without any
+ * kernel request: their descriptors are initialized data, their stacks are
+ * sized per task and fixed at link time, and main() does not create a_main.
+ * Leave a list undefined to create those objects at run time as before.
+ *
+ * Each list is an X-macro. os.h turns every entry into a handle the
+ * application can use directly:
+ *
+ *   TASK(f, py, arg, stacksize)   ->  PID   f_PID    f runs at priority py
+ *   MUTEX_(name)                  ->  MUTEX name     already Mutex_Init()ed
+ *   EVENT_(name)                  ->  EVENT name     already Event_Init()ed
+ *
+ * A stack must hold the 40-byte initial frame plus the deepest call chain of
+ * the task and of any ISR that may interrupt it. Static tasks take the lowest
+ * PIDs, so MAXTHREAD must leave room for them plus any Task_Create() calls.
+ *
+ * MAXMUTEX and MAXEVENT may also be set here; MAXMUTEX 0 removes the mutex
+ * service altogether.
+ */
+
+/*
+#define OS_STATIC_TASKS(TASK) \
+	TASK(producer, 1, 0, 128) \
+	TASK(consumer, 2, 0, 128)
+
+#define OS_STATIC_MUTEXES(MUTEX_) \
+	MUTEX_(buffer_lock)
+
+#define OS_STATIC_EVENTS(EVENT_) \
+	EVENT_(data_ready)
+
+#define MAXMUTEX 1
+#define MAXEVENT 2
+*/
+
+#endif /* _OS_CONFIG_H_ */
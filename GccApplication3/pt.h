@@ -0,0 +1,42 @@
+/**
+ * @file   pt.h
+ * @brief  Local-continuation macros for protothreads (see Pt_Create()).
+ *
+ * A protothread is a function that returns whenever it has to wait and is
+ * re-entered at the same spot when the wait is over. It has no stack of its
+ * own, so local variables do NOT survive a wait; keep state in statics.
+ * Waits may only appear in the protothread function itself, and not inside
+ * a switch statement of its own.
+ *
+ *   void Blinker()
+ *   {
+ *       PT_BEGIN();
+ *       for(;;){
+ *           PORTA ^= (1<<PA0);
+ *           PT_SLEEP(50);
+ *       }
+ *       PT_END();
+ *   }
+ */
+#ifndef __PT_H__
+#define __PT_H__
+
+#include "os.h"
+
+#define PT_BEGIN()          { unsigned int* pt_lc_ = Pt_Lc(); switch(*pt_lc_) { case 0:
+
+#define PT_END()            } *pt_lc_ = 0; }
+
+/** Leave the protothread; the next activation starts it from the top. */
+#define PT_EXIT()           do { *pt_lc_ = 0; return; } while(0)
+
+#define PT_WAIT_EVENT(e)    do { *pt_lc_ = __LINE__; Pt_Wait_Event(e); return; case __LINE__:; } while(0)
+
+#define PT_SLEEP(t)         do { *pt_lc_ = __LINE__; Pt_Sleep(t); return; case __LINE__:; } while(0)
+
+#define PT_YIELD()          do { *pt_lc_ = __LINE__; Pt_Yield(); return; case __LINE__:; } while(0)
+
+/** Polls cond, yielding to equal and higher priorities in between. */
+#define PT_WAIT_UNTIL(cond) do { *pt_lc_ = __LINE__; case __LINE__: if(!(cond)){ Pt_Yield(); return; } } while(0)
+
+#endif